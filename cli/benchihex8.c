@@ -0,0 +1,283 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "mio.h"
+#include "load.h"
+#include "../ihex8.h"
+
+#define RECORDS 200000
+#define RECORD_LENGTH 32
+#define REPEAT 5
+#define ADDRESS_SPACE 0x10000L
+
+typedef struct
+{
+  long records;
+  int length;
+  int repeat;
+} options_s;
+
+options_s options = { RECORDS, RECORD_LENGTH, REPEAT };
+
+typedef struct
+{
+  const char *name;
+  double (*run)(mio_s *mio);
+} bench_s;
+
+int parse_options(const int argc, const char* argv[]);
+char* generate(long records, int length, size_t* len);
+double now(void);
+void report(const char *name, double seconds, size_t bytes);
+
+double bench_load(mio_s *mio);
+double bench_load_and_store(mio_s *mio);
+double bench_load_image(mio_s *mio);
+double bench_dump(mio_s *mio);
+double bench_load_buffer(mio_s *mio);
+double bench_load_threads(mio_s *mio);
+double load_with(mio_s *mio, int threads);
+int bench_scaling(const char *text, size_t len, long passes);
+void sum_record(IHex8Record* rec, void* ctx);
+
+bench_s benches[] = {
+  { "ihex8Load", bench_load },
+  { "ihex8LoadAndStore", bench_load_and_store },
+  { "ihex8LoadImage", bench_load_image },
+  { "ihex8Dump", bench_dump },
+  { "load_buffer", bench_load_buffer },
+  { "load_buffer, threads", bench_load_threads },
+  { NULL, NULL }
+};
+
+int main(const int argc, const char* argv[]) {
+  if (parse_options(argc, argv) != 0) return 1;
+
+  /* one pass fills at most the 64K address space, more are loaded again */
+  long per_pass = ADDRESS_SPACE / options.length;
+  if (per_pass > options.records) per_pass = options.records;
+  long passes = (options.records + per_pass - 1) / per_pass;
+  options.records = per_pass * passes;
+
+  size_t len;
+  char *text = generate(per_pass, options.length, &len);
+  if (text == NULL) {
+    fputs("out of memory\n", stderr);
+    return 1;
+  }
+
+  fprintf(stdout, "%ld records of %d bytes, %ld pass(es) of %zu bytes of text\n", 
+      options.records, options.length, passes, len);
+
+  mio_s mio;
+  mio_init(&mio, text, len);
+  for (bench_s *b = benches; b->name != NULL; b++) {
+    double best = -1;
+    for (int i = 0; i < options.repeat; i++) {
+      double t = 0;
+      for (long j = 0; j < passes; j++) {
+        mio_rewind(&mio);
+        double pass = b->run(&mio);
+        if (pass < 0) {
+          fprintf(stderr, "%s failed\n", b->name);
+          return 1;
+        }
+        t += pass;
+      }
+      if (best < 0 || t < best) best = t;
+    }
+    report(b->name, best, len * passes);
+  }
+
+  mio_cleanup(&mio);
+  int rc = bench_scaling(text, len, passes);
+  free(text);
+  return rc;
+}
+
+int parse_options(const int argc, const char* argv[]) {
+  static struct option longopts[] = {
+    { "records", required_argument, NULL, 'n' },
+    { "length", required_argument, NULL, 'l' },
+    { "repeat", required_argument, NULL, 'r' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  while ((c = getopt_long(argc, (char* const*) argv, "n:l:r:", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'n':
+        options.records = strtol(optarg, NULL, 10);
+        break;
+      case 'l':
+        options.length = atoi(optarg);
+        break;
+      case 'r':
+        options.repeat = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n records] [-l length] [-r repeat]\n", argv[0]);
+        return -1;
+    }
+  }
+  if (options.records < 1 || options.length < 1 || options.length > 255 
+      || options.repeat < 1) {
+    fputs("invalid benchmark parameters\n", stderr);
+    return -1;
+  }
+  return 0;
+}
+
+char* generate(long records, int length, size_t* len) {
+  size_t size = (size_t) records * (2*length + 12) + 13;
+  char *text = malloc(size);
+  if (text == NULL) return NULL;
+
+  char *p = text;
+  uint16_t address = 0;
+  srand(1);
+  for (long i = 0; i < records; i++) {
+    uint8_t sum = length + (address >> 8) + (address & 0xff);
+    p += sprintf(p, ":%02X%04X00", length, address);
+    for (int j = 0; j < length; j++) {
+      uint8_t b = rand() & 0xff;
+      sum += b;
+      p += sprintf(p, "%02X", b);
+    }
+    p += sprintf(p, "%02X\n", (uint8_t) -sum);
+    address += length;
+  }
+  p += sprintf(p, ":00000001FF\n");
+  *len = p - text;
+  return text;
+}
+
+double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char *name, double seconds, size_t bytes) {
+  fprintf(stdout, "%-20s %10.3f ms %12.0f records/s %8.2f MB/s\n", name, 
+      seconds * 1e3, options.records / seconds, bytes / seconds / 1e6);
+}
+
+double bench_load(mio_s *mio) {
+  IHex8 ih;
+  mio_ihex8(mio, &ih);
+  double start = now();
+  IHex8Record* rex = ihex8Load(&ih);
+  double t = now() - start;
+  if (rex == NULL) return -1;
+  ihex8Free(rex);
+  return t;
+}
+
+double bench_load_and_store(mio_s *mio) {
+  IHex8 ih;
+  unsigned long sum = 0;
+  mio_ihex8(mio, &ih);
+  double start = now();
+  int rc = ihex8LoadAndStore(&ih, &sum, sum_record);
+  double t = now() - start;
+  return rc == 0 && sum != 0 ? t : -1;
+}
+
+double bench_load_image(mio_s *mio) {
+  IHex8 ih;
+  mio_ihex8(mio, &ih);
+  double start = now();
+  IHex8Image* image = ihex8LoadImage(&ih, 6);
+  double t = now() - start;
+  if (image == NULL) return -1;
+  ihex8ImageFree(image);
+  return t;
+}
+
+double bench_dump(mio_s *mio) {
+  IHex8 ih;
+  mio_ihex8(mio, &ih);
+  IHex8Record* rex = ihex8Load(&ih);
+  if (rex == NULL) return -1;
+
+  mio->outlen = 0;
+  double start = now();
+  ihex8Dump(rex, &ih);
+  double t = now() - start;
+  ihex8Free(rex);
+  return mio->outlen == mio->inlen ? t : -1;
+}
+
+double bench_load_buffer(mio_s *mio) {
+  return load_with(mio, 1);
+}
+
+double bench_load_threads(mio_s *mio) {
+  return load_with(mio, load_threads());
+}
+
+double load_with(mio_s *mio, int threads) {
+  IHex8Image* image;
+  double start = now();
+  int rc = load_buffer(mio->in, mio->inlen, 6, threads, stderr, &image);
+  double t = now() - start;
+  if (rc != LOAD_OK) return -1;
+  ihex8ImageFree(image);
+  return t;
+}
+
+int bench_scaling(const char *text, size_t len, long passes) {
+  /* one pass is too small to split across many workers, so all of them
+   * are loaded as one file that rewrites the address space each pass */
+  static const char eof[] = ":00000001FF\n";
+  size_t body = len - strlen(eof);
+  size_t size = body * passes + strlen(eof);
+  char *stacked = malloc(size);
+  FILE *quiet = fopen("/dev/null", "w");
+  if (stacked == NULL || quiet == NULL) {
+    fputs("out of memory\n", stderr);
+    free(stacked);
+    if (quiet != NULL) fclose(quiet);
+    return 1;
+  }
+  for (long i = 0; i < passes; i++) {
+    memcpy(stacked + body * i, text, body);
+  }
+  memcpy(stacked + body * passes, eof, strlen(eof));
+
+  int cores = load_threads();
+  fprintf(stdout, "one file of %zu bytes of text, %d core(s)\n", size, cores);
+  int rc = 0;
+  for (int threads = 1; threads <= cores && rc == 0; 
+      threads = threads < cores && threads * 2 > cores ? cores : threads * 2) {
+    double best = -1;
+    for (int i = 0; i < options.repeat; i++) {
+      IHex8Image* image;
+      double start = now();
+      if (load_buffer(stacked, size, 6, threads, quiet, &image) != LOAD_OK) {
+        fprintf(stderr, "load_buffer with %d thread(s) failed\n", threads);
+        rc = 1;
+        break;
+      }
+      double t = now() - start;
+      ihex8ImageFree(image);
+      if (best < 0 || t < best) best = t;
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "%d thread(s)", threads);
+    if (rc == 0) report(name, best, size);
+  }
+  fclose(quiet);
+  free(stacked);
+  return rc;
+}
+
+void sum_record(IHex8Record* rec, void* ctx) {
+  unsigned long* sum = (unsigned long*) ctx;
+  for (int i = 0; i < rec->length; i++) {
+    *sum += rec->data[i];
+  }
+}
@@ -0,0 +1,425 @@
+/*
+ * bridge.c *
+ * serve a serial controller over tcp, one client at a time
+ *
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <getopt.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "sio.h"
+#include "nio.h"
+#include "../ihex8.h"
+
+#define PORT "/dev/cu.usbmodem14101"
+#define LISTEN_HOST NIO_HOST
+#define LISTEN_PORT NIO_PORT
+#define MAX_EVENTS 16
+#define CHUNK 4096
+#define KEEPALIVE 500           /* ms between INFO lines to queued clients */
+
+#define FORWARD_OK 0
+#define FORWARD_SOURCE -1       /* reading side closed or failed */
+#define FORWARD_SINK -2         /* writing side closed or failed */
+
+typedef struct client_t
+{
+  struct client_t *next;
+  int fd;
+  int ahead;                    /* queue position last told to the client */
+} client_s;
+
+typedef struct
+{
+  sio_s sio;
+  int listen_fd;
+  int epoll_fd;
+  int active;                   /* client that owns the controller, or -1 */
+  client_s *waiting;            /* clients queued behind it, oldest first */
+  int pipe[2];                  /* kernel buffer that splice moves data through */
+  int copy;                     /* splice is unsupported, fall back to read/write */
+} bridge_s;
+
+typedef struct
+{
+  const char *port;
+  long baud;
+  const char *host;
+  const char *service;
+} options_s;
+
+options_s options = { PORT, 115200, LISTEN_HOST, LISTEN_PORT };
+
+int parse_options(const int argc, char *argv[]);
+void usage(const char *prog);
+
+int open_listener(bridge_s *b);
+void accept_client(bridge_s *b);
+void close_client(bridge_s *b, int fd);
+void promote_client(bridge_s *b);
+void drain_waiting(bridge_s *b, int fd);
+void keep_waiting(bridge_s *b);
+long now_ms(void);
+int forward(bridge_s *b, int from, int to);
+int copy_out(int from, int to, ssize_t n);
+int write_all(int to, const char *buf, ssize_t n);
+int watch(bridge_s *b, int fd);
+
+int main(const int argc, char *argv[])
+{
+  bridge_s b;
+  if (parse_options(argc, argv) != 0) return 1;
+
+  memset(&b, 0, sizeof(b));
+  b.active = -1;
+  sio_init(&b.sio);
+  b.sio.info.port = options.port;
+  b.sio.info.baud = options.baud;
+  if (sio_open(&b.sio) != 0) {
+    perror(options.port);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  if (pipe2(b.pipe, O_NONBLOCK) == -1) {
+    perror("pipe2");
+    return 1;
+  }
+  b.epoll_fd = epoll_create1(0);
+  if (b.epoll_fd == -1) {
+    perror("epoll_create1");
+    return 1;
+  }
+  if (open_listener(&b) != 0) return 1;
+  if (watch(&b, b.sio.fd) != 0 || watch(&b, b.listen_fd) != 0) return 1;
+  fprintf(stdout, "Bridging %s to %s:%s\n", options.port, options.host, options.service);
+  fflush(stdout);
+
+  struct epoll_event events[MAX_EVENTS];
+  int running = 1;
+  long keepalive = now_ms();
+  while (running) {
+    int n = epoll_wait(b.epoll_fd, events, MAX_EVENTS, KEEPALIVE);
+    if (n == -1) {
+      if (errno == EINTR) continue;
+      perror("epoll_wait");
+      return 1;
+    }
+
+    for (int i = 0; i < n; i++) {
+      int fd = events[i].data.fd;
+      if (fd == b.listen_fd) {
+        accept_client(&b);
+      }
+      else if (fd == b.sio.fd) {
+        char buf[CHUNK];
+        int rc = b.active != -1 ? forward(&b, b.sio.fd, b.active)
+            /* nobody is listening: drop stale controller output */
+            : read(b.sio.fd, buf, sizeof(buf)) > 0 ? FORWARD_OK : FORWARD_SOURCE;
+        if (rc == FORWARD_SINK) close_client(&b, b.active);
+        if (rc == FORWARD_SOURCE) running = 0;
+      }
+      else if (fd == b.active) {
+        int rc = forward(&b, fd, b.sio.fd);
+        if (rc == FORWARD_SOURCE) close_client(&b, fd);
+        if (rc == FORWARD_SINK) running = 0;
+      }
+      else {
+        drain_waiting(&b, fd);
+      }
+    }
+
+    if (now_ms() - keepalive >= KEEPALIVE) {
+      keep_waiting(&b);
+      keepalive = now_ms();
+    }
+  }
+
+  fprintf(stderr, "%s: controller connection lost\n", options.port);
+  return 1;
+}
+
+int parse_options(const int argc, char *argv[])
+{
+  static struct option longopts[] = {
+    { "port", required_argument, NULL, 'p' },
+    { "baud", required_argument, NULL, 'b' },
+    { "listen", required_argument, NULL, 'l' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  char *colon;
+  while ((c = getopt_long(argc, argv, "p:b:l:h", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'p':
+        options.port = optarg;
+        break;
+      case 'b':
+        options.baud = strtol(optarg, NULL, 10);
+        break;
+      case 'l':
+        colon = strrchr(optarg, ':');
+        if (colon != NULL) {
+          *colon = '\0';
+          options.host = optarg;
+          options.service = colon + 1;
+        }
+        else {
+          options.service = optarg;
+        }
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  return 0;
+}
+
+void usage(const char *prog)
+{
+  fprintf(stderr, "usage: %s [-p port] [-b baud] [-l [host:]port]\n", prog);
+  fputs("  -p, --port=PATH   serial port of the controller\n", stderr);
+  fputs("  -b, --baud=N      serial speed (default 115200)\n", stderr);
+  fputs("  -l, --listen=ADDR tcp address to serve (default "
+      LISTEN_HOST ":" LISTEN_PORT ")\n", stderr);
+}
+
+int open_listener(bridge_s *b)
+{
+  struct addrinfo hints;
+  struct addrinfo *addrs = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = PF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+
+  int rc = getaddrinfo(options.host, options.service, &hints, &addrs);
+  if (rc != 0) {
+    fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rc));
+    return -1;
+  }
+
+  int fd = -1;
+  const char *cause = NULL;
+  for (struct addrinfo *addr = addrs; addr != NULL; addr = addr->ai_next) {
+    fd = socket(addr->ai_family, addr->ai_socktype, addr->ai_protocol);
+    if (fd == -1) {
+      cause = "socket";
+      continue;
+    }
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(fd, addr->ai_addr, addr->ai_addrlen) == -1 || listen(fd, 8) == -1) {
+      cause = "bind";
+      close(fd);
+      fd = -1;
+      continue;
+    }
+    break;
+  }
+  freeaddrinfo(addrs);
+
+  if (fd == -1) {
+    perror(cause);
+    return -1;
+  }
+  b->listen_fd = fd;
+  return 0;
+}
+
+void accept_client(bridge_s *b)
+{
+  int fd = accept(b->listen_fd, NULL, NULL);
+  if (fd == -1) {
+    perror("accept");
+    return;
+  }
+  if (watch(b, fd) != 0) {
+    close(fd);
+    return;
+  }
+
+  if (b->active == -1) {
+    b->active = fd;
+    fprintf(stdout, "Client %d connected\n", fd);
+  }
+  else {
+    client_s *client = (client_s *) malloc(sizeof(client_s));
+    if (client == NULL) {
+      close(fd);
+      return;
+    }
+    client->fd = fd;
+    client->ahead = 0;
+    client->next = NULL;
+    client_s **tail = &b->waiting;
+    while (*tail != NULL) tail = &(*tail)->next;
+    *tail = client;
+    fprintf(stdout, "Client %d queued\n", fd);
+  }
+  fflush(stdout);
+}
+
+void close_client(bridge_s *b, int fd)
+{
+  epoll_ctl(b->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+  close(fd);
+  fprintf(stdout, "Client %d disconnected\n", fd);
+  fflush(stdout);
+
+  if (fd == b->active) {
+    b->active = -1;
+    promote_client(b);
+    return;
+  }
+  for (client_s **p = &b->waiting; *p != NULL; p = &(*p)->next) {
+    if ((*p)->fd == fd) {
+      client_s *client = *p;
+      *p = client->next;
+      free(client);
+      return;
+    }
+  }
+}
+
+void promote_client(bridge_s *b)
+{
+  client_s *client = b->waiting;
+  if (client == NULL) return;
+  b->waiting = client->next;
+  b->active = client->fd;
+  free(client);
+
+  /* the new client starts from a clean line, not the last one's leftovers */
+  char buf[CHUNK];
+  while (read(b->pipe[0], buf, sizeof(buf)) > 0) continue;
+  tcflush(b->sio.fd, TCIOFLUSH);
+  fprintf(stdout, "Client %d connected\n", b->active);
+  fflush(stdout);
+}
+
+void drain_waiting(bridge_s *b, int fd)
+{
+  /* queued clients ping to sync; the controller is not theirs yet */
+  char buf[CHUNK];
+  if (read(fd, buf, sizeof(buf)) <= 0) {
+    close_client(b, fd);
+  }
+}
+
+void keep_waiting(bridge_s *b)
+{
+  /* INFO lines keep a queued client from timing out its sync; only
+   * a change of position is worth printing */
+  char message[64];
+  int ahead = 1;
+  client_s *client = b->waiting;
+  while (client != NULL) {
+    client_s *next = client->next;
+    int length = client->ahead == ahead
+        ? snprintf(message, sizeof(message), "%s\n", MSG_INFO)
+        : snprintf(message, sizeof(message),
+            "%s Waiting for controller, %d client(s) ahead\n", MSG_INFO, ahead);
+    client->ahead = ahead;
+    if (write(client->fd, message, length) != length) {
+      close_client(b, client->fd);
+    }
+    else {
+      ahead++;
+    }
+    client = next;
+  }
+}
+
+int forward(bridge_s *b, int from, int to)
+{
+  if (!b->copy) {
+    ssize_t n = splice(from, NULL, b->pipe[1], NULL, CHUNK,
+        SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n == -1 && errno == EINVAL) {
+      /* some tty drivers cannot splice; copy from then on */
+      fputs("splice unsupported, copying instead\n", stderr);
+      b->copy = 1;
+    }
+    else {
+      if (n == -1) return errno == EAGAIN ? FORWARD_OK : FORWARD_SOURCE;
+      if (n == 0) return FORWARD_SOURCE;
+      while (n > 0) {
+        ssize_t m = splice(b->pipe[0], NULL, to, NULL, n, SPLICE_F_MOVE);
+        if (m == -1 && errno == EINVAL) {
+          /* the sink cannot splice; copy out what the pipe holds */
+          fputs("splice unsupported, copying instead\n", stderr);
+          b->copy = 1;
+          return copy_out(b->pipe[0], to, n);
+        }
+        if (m <= 0) return FORWARD_SINK;
+        n -= m;
+      }
+      return FORWARD_OK;
+    }
+  }
+
+  char buf[CHUNK];
+  ssize_t n = read(from, buf, sizeof(buf));
+  if (n == -1) return errno == EAGAIN ? FORWARD_OK : FORWARD_SOURCE;
+  if (n == 0) return FORWARD_SOURCE;
+  return write_all(to, buf, n);
+}
+
+int copy_out(int from, int to, ssize_t n)
+{
+  /* the n bytes are already in from, so only the sink can fail here */
+  char buf[CHUNK];
+  while (n > 0) {
+    ssize_t got = read(from, buf, n < CHUNK ? n : CHUNK);
+    if (got <= 0) return FORWARD_SINK;
+    if (write_all(to, buf, got) != FORWARD_OK) return FORWARD_SINK;
+    n -= got;
+  }
+  return FORWARD_OK;
+}
+
+int write_all(int to, const char *buf, ssize_t n)
+{
+  for (ssize_t done = 0; done < n; ) {
+    ssize_t m = write(to, buf + done, n - done);
+    if (m <= 0) return FORWARD_SINK;
+    done += m;
+  }
+  return FORWARD_OK;
+}
+
+int watch(bridge_s *b, int fd)
+{
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(b->epoll_fd, EPOLL_CTL_ADD, fd, &event) == -1) {
+    perror("epoll_ctl");
+    return -1;
+  }
+  return 0;
+}
+
+long now_ms(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
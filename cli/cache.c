@@ -0,0 +1,278 @@
+/*
+ * cache.c *
+ * local store of what was last written to each chip
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "cache.h"
+#include "fio.h"
+
+static const char *cache_dir(char *buf, size_t size);
+static int make_dirs(char *path);
+static IHex8Image *read_image(const uint8_t *map, size_t size, uint8_t page_bits);
+
+int cache_path(char *buf, size_t size, const char *kind, const char *key)
+{
+  char dir[PATH_MAX];
+  if (cache_dir(dir, sizeof(dir)) == NULL) return -1;
+
+  /* keys come from the command line; keep them to one path component */
+  char name[NAME_MAX + 1];
+  size_t n = 0;
+  for (; key[n] != '\0' && n < sizeof(name) - 1; n++) {
+    unsigned char c = key[n];
+    name[n] = isalnum(c) || c == '-' || c == '_' || c == '.' ? c : '_';
+  }
+  name[n] = '\0';
+  if (n == 0 || name[0] == '.') return -1;
+
+  int length = snprintf(buf, size, "%s/%s/%s", dir, kind, name);
+  return length < 0 || (size_t) length >= size ? -1 : 0;
+}
+
+FILE *cache_open(const char *kind, const char *key)
+{
+  char path[PATH_MAX];
+  if (cache_path(path, sizeof(path), kind, key) != 0) return NULL;
+  return fopen(path, "rb");
+}
+
+FILE *cache_create(cache_entry_s *e, const char *kind, const char *key, FILE *err)
+{
+  e->fp = NULL;
+  if (cache_path(e->path, sizeof(e->path), kind, key) != 0) return NULL;
+
+  char dir[PATH_MAX];
+  snprintf(dir, sizeof(dir), "%s", e->path);
+  *strrchr(dir, '/') = '\0';
+  if (make_dirs(dir) != 0) {
+    fprintf(err, "%s: %s\n", dir, strerror(errno));
+    return NULL;
+  }
+
+  /* readers only ever see a complete entry or the previous one */
+  int n = snprintf(e->temp, sizeof(e->temp), "%s.%ld", e->path, (long) getpid());
+  if (n < 0 || n >= (int) sizeof(e->temp)) {
+    fprintf(err, "cache path too long: %s\n", e->path);
+    return NULL;
+  }
+  e->fp = fopen(e->temp, "wb");
+  if (e->fp == NULL) fprintf(err, "%s: %s\n", e->temp, strerror(errno));
+  return e->fp;
+}
+
+int cache_commit(cache_entry_s *e, FILE *err)
+{
+  int rc = ferror(e->fp) ? -1 : 0;
+  if (fclose(e->fp) != 0) rc = -1;
+  e->fp = NULL;
+  if (rc == 0 && rename(e->temp, e->path) != 0) rc = -1;
+  if (rc != 0) {
+    fprintf(err, "%s: %s\n", e->path, strerror(errno));
+    unlink(e->temp);
+  }
+  return rc;
+}
+
+void cache_abandon(cache_entry_s *e)
+{
+  if (e->fp == NULL) return;
+  fclose(e->fp);
+  e->fp = NULL;
+  unlink(e->temp);
+}
+
+int cache_load_chip(chip_state_s *s, const char *id, uint8_t page_bits, FILE *err)
+{
+  memset(s, 0, sizeof(chip_state_s));
+  FILE *fp = cache_open(CACHE_CHIPS, id);
+  if (fp == NULL) return -1;
+
+  /* one header line, then the known bytes as plain Intel HEX */
+  char line[128];
+  char device[sizeof(s->device)];
+  unsigned int crc;
+  int rc = -1;
+  if (fgets(line, sizeof(line), fp) != NULL
+      && strncmp(line, CACHE_CHIP_TAG " ", strlen(CACHE_CHIP_TAG) + 1) == 0
+      && sscanf(line + strlen(CACHE_CHIP_TAG), " %31s %4x", device, &crc) == 2) {
+    fio_s io = { fp, NULL, err };
+    IHex8 ih;
+    fio_ihex8(&io, &ih);
+    s->image = ihex8LoadImage(&ih, page_bits);
+    if (s->image != NULL) {
+      snprintf(s->device, sizeof(s->device), "%s", device);
+      s->crc = (uint16_t) crc;
+      rc = 0;
+    }
+  }
+  fclose(fp);
+  return rc;
+}
+
+int cache_save_chip(chip_state_s *s, const char *id, FILE *err)
+{
+  cache_entry_s e;
+  FILE *fp = cache_create(&e, CACHE_CHIPS, id, err);
+  if (fp == NULL) return -1;
+
+  IHex8Record *rex = ihex8ImageRecords(s->image, CACHE_RECORD_SIZE);
+  fprintf(fp, "%s %s %04X\n", CACHE_CHIP_TAG, s->device, s->crc);
+  fio_s io = { NULL, fp, err };
+  IHex8 ih;
+  fio_ihex8(&io, &ih);
+  ihex8Dump(rex, &ih);
+  ihex8Free(rex);
+  return cache_commit(&e, err);
+}
+
+void cache_free_chip(chip_state_s *s)
+{
+  ihex8ImageFree(s->image);
+  s->image = NULL;
+}
+
+uint64_t cache_hash(const void *data, size_t size, uint64_t hash)
+{
+  const uint8_t *p = (const uint8_t *) data;
+  for (size_t i = 0; i < size; i++) {
+    hash = (hash ^ p[i]) * 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+int cache_load_image(const char *key, uint8_t page_bits, IHex8Image **image)
+{
+  *image = NULL;
+  FILE *fp = cache_open(CACHE_IMAGES, key);
+  if (fp == NULL) return -1;
+
+  struct stat st;
+  void *map = MAP_FAILED;
+  if (fstat(fileno(fp), &st) == 0 && st.st_size > 0) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+  }
+  fclose(fp);
+  if (map == MAP_FAILED) return -1;
+
+  *image = read_image((const uint8_t *) map, st.st_size, page_bits);
+  munmap(map, st.st_size);
+  return *image != NULL ? 0 : -1;
+}
+
+int cache_save_image(const char *key, IHex8Image *image, FILE *err)
+{
+  cache_entry_s e;
+  FILE *fp = cache_create(&e, CACHE_IMAGES, key, err);
+  if (fp == NULL) return -1;
+
+  /* the header goes in last, once the checksum is known */
+  size_t size = 1U << image->pageBits;
+  size_t map_size = (size + 7) / 8;
+  image_header_s h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, CACHE_IMAGE_MAGIC, sizeof(h.magic));
+  h.version = CACHE_IMAGE_VERSION;
+  h.page_bits = image->pageBits;
+  h.checksum = CACHE_HASH_SEED;
+  fwrite(&h, sizeof(h), 1, fp);
+
+  IHex8Page *page = NULL;
+  while ((page = ihex8ImageNext(image, page)) != NULL) {
+    image_page_s entry = { page->address, page->count, 0 };
+    h.checksum = cache_hash(&entry, sizeof(entry), h.checksum);
+    h.checksum = cache_hash(page->data, size, h.checksum);
+    h.checksum = cache_hash(page->present, map_size, h.checksum);
+    fwrite(&entry, sizeof(entry), 1, fp);
+    fwrite(page->data, 1, size, fp);
+    fwrite(page->present, 1, map_size, fp);
+    h.page_count++;
+  }
+  rewind(fp);
+  fwrite(&h, sizeof(h), 1, fp);
+  return cache_commit(&e, err);
+}
+
+static IHex8Image *read_image(const uint8_t *map, size_t size, uint8_t page_bits)
+{
+  /* anything that does not check out is a miss, never an error */
+  image_header_s h;
+  size_t page_size = 1U << page_bits;
+  size_t map_size = (page_size + 7) / 8;
+  size_t stride = sizeof(image_page_s) + page_size + map_size;
+  if (size < sizeof(h)) return NULL;
+  memcpy(&h, map, sizeof(h));
+  if (memcmp(h.magic, CACHE_IMAGE_MAGIC, sizeof(h.magic)) != 0
+      || h.version != CACHE_IMAGE_VERSION || h.page_bits != page_bits
+      || size != sizeof(h) + (size_t) h.page_count * stride
+      || cache_hash(map + sizeof(h), size - sizeof(h), CACHE_HASH_SEED) != h.checksum) {
+    return NULL;
+  }
+
+  IHex8Image *image = ihex8ImageCreate(page_bits);
+  if (image == NULL) return NULL;
+  for (uint32_t i = 0; i < h.page_count; i++) {
+    const uint8_t *p = map + sizeof(h) + i * stride;
+    image_page_s entry;
+    memcpy(&entry, p, sizeof(entry));
+    const uint8_t *data = p + sizeof(entry);
+    const uint8_t *present = data + page_size;
+    uint32_t first = 0;
+    while (first < page_size && !((present[first >> 3] >> (first & 7)) & 1)) first++;
+    if (entry.address >= image->pageCount || first == page_size) goto error;
+
+    /* let ihex8.c allocate the page, then fill it whole */
+    uint16_t base = entry.address << page_bits;
+    if (ihex8ImagePut(image, base + first, data[first]) < 0) goto error;
+    IHex8Page *page = ihex8ImagePage(image, base);
+    memcpy(page->data, data, page_size);
+    memcpy(page->present, present, map_size);
+    page->count = entry.count;
+  }
+  return image;
+
+error:
+  ihex8ImageFree(image);
+  return NULL;
+}
+
+static const char *cache_dir(char *buf, size_t size)
+{
+  const char *dir = getenv(CACHE_ENV);
+  const char *xdg = getenv("XDG_CACHE_HOME");
+  const char *home = getenv("HOME");
+  int length;
+  if (dir != NULL && dir[0] != '\0') {
+    length = snprintf(buf, size, "%s", dir);
+  }
+  else if (xdg != NULL && xdg[0] != '\0') {
+    length = snprintf(buf, size, "%s/sendihex8", xdg);
+  }
+  else if (home != NULL && home[0] != '\0') {
+    length = snprintf(buf, size, "%s/.cache/sendihex8", home);
+  }
+  else {
+    return NULL;
+  }
+  return length < 0 || (size_t) length >= size ? NULL : buf;
+}
+
+static int make_dirs(char *path)
+{
+  for (char *p = path + 1; *p != '\0'; p++) {
+    if (*p != '/') continue;
+    *p = '\0';
+    int rc = mkdir(path, 0755);
+    *p = '/';
+    if (rc != 0 && errno != EEXIST) return -1;
+  }
+  return mkdir(path, 0755) != 0 && errno != EEXIST ? -1 : 0;
+}
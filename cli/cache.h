@@ -0,0 +1,63 @@
+#ifndef cache_h
+#define cache_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include "../ihex8.h"
+
+#define CACHE_ENV "SENDIHEX8_CACHE"	/* overrides the cache directory */
+#define CACHE_CHIPS "chips"
+#define CACHE_CHIP_TAG "# sendihex8 chip"
+#define CACHE_RECORD_SIZE 32
+#define CACHE_IMAGES "images"
+#define CACHE_IMAGE_MAGIC "SIHX8IMG"
+#define CACHE_IMAGE_VERSION 1
+#define CACHE_HASH_SEED 0xcbf29ce484222325ULL	/* FNV-1a 64 offset basis */
+
+typedef struct
+{
+	char path[PATH_MAX];	/* name of the finished entry */
+	char temp[PATH_MAX];	/* written here, renamed over it on commit */
+	FILE *fp;
+} cache_entry_s;
+
+typedef struct
+{
+	char device[32];	/* part the chip was written as */
+	uint16_t crc;		/* of the whole chip right after that */
+	IHex8Image *image;	/* bytes known to be on it */
+} chip_state_s;
+
+typedef struct
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t page_bits;
+	uint32_t page_count;	/* entries that follow */
+	uint32_t reserved;
+	uint64_t checksum;	/* cache_hash of all of them */
+} image_header_s;
+
+typedef struct
+{
+	uint16_t address;	/* page number */
+	uint16_t count;		/* bytes present */
+	uint32_t reserved;	/* then the page's data and presence map, as in memory */
+} image_page_s;
+
+int cache_path(char *buf, size_t size, const char *kind, const char *key);
+FILE *cache_open(const char *kind, const char *key);
+FILE *cache_create(cache_entry_s *e, const char *kind, const char *key, FILE *err);
+int cache_commit(cache_entry_s *e, FILE *err);
+void cache_abandon(cache_entry_s *e);
+
+int cache_load_chip(chip_state_s *s, const char *id, uint8_t page_bits, FILE *err);
+int cache_save_chip(chip_state_s *s, const char *id, FILE *err);
+void cache_free_chip(chip_state_s *s);
+
+uint64_t cache_hash(const void *data, size_t size, uint64_t hash);
+int cache_load_image(const char *key, uint8_t page_bits, IHex8Image **image);
+int cache_save_image(const char *key, IHex8Image *image, FILE *err);
+
+#endif	/* cache_h */
@@ -0,0 +1,45 @@
+/*
+ * fio.c *
+ * stdio stream routines
+ *
+ */ 
+#include <stdio.h>
+
+#include "fio.h"
+
+static int ihex8_readc(void *ctx);
+static int ihex8_writec(void *ctx, char c);
+static int ihex8_writeln(void *ctx, const char *s);
+static void ihex8_report(void *ctx, int kind, const char *s);
+
+void fio_ihex8(fio_s *fio, IHex8 *ih)
+{
+  ih->readc = ihex8_readc;
+  ih->readln = NULL;
+  ih->writec = ihex8_writec;
+  ih->writeln = ihex8_writeln;
+  ih->ctx = fio;
+  ih->report = ihex8_report;
+}
+
+static int ihex8_readc(void *ctx)
+{
+  return fgetc(((fio_s *) ctx)->in);
+}
+
+static int ihex8_writec(void *ctx, char c)
+{
+  return fputc(c, ((fio_s *) ctx)->out);
+}
+
+static int ihex8_writeln(void *ctx, const char *s)
+{
+  fputs(s, ((fio_s *) ctx)->out);
+  return fputc('\n', ((fio_s *) ctx)->out);
+}
+
+static void ihex8_report(void *ctx, int kind, const char *s)
+{
+  FILE *err = ((fio_s *) ctx)->err;
+  if (err != NULL) fprintf(err, "%s\n", s);
+}
@@ -0,0 +1,16 @@
+#ifndef fio_h 
+#define fio_h
+
+#include <stdio.h>
+#include "../ihex8.h"
+
+typedef struct
+{
+	FILE *in;
+	FILE *out;
+	FILE *err;		/* diagnostics, or NULL */
+} fio_s;
+
+void fio_ihex8(fio_s *fio, IHex8 *ih);
+
+#endif	/* fio_h */
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include "mio.h"
+#include "../ihex8.h"
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+void check_compress(IHex8Image* image);
+void store_record(IHex8Record* rec, void* ctx);
+int run_command(char* line, char* reply, int replylen, void* ctx);
+uint8_t* claim_page(uint16_t address, uint8_t* length, void* ctx);
+void commit_page(void* ctx);
+void discard_page(void* ctx);
+const char* verify_pages(uint8_t final, void* ctx);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  mio_s mio;
+  IHex8 ih;
+  unsigned long sum = 0;
+
+  mio_init(&mio, (const char*) data, size);
+  mio_ihex8(&mio, &ih);
+
+  ihex8Free(ihex8Load(&ih));
+
+  mio_rewind(&mio);
+  ihex8LoadAndStore(&ih, &sum, store_record);
+
+  mio_rewind(&mio);
+  IHex8Image* image = ihex8LoadImage(&ih, 6);
+  if (image != NULL) {
+    check_compress(image);
+    ihex8ImageFree(image);
+  }
+
+  mio_rewind(&mio);
+  IHex8Handler handler = { store_record, run_command, &sum, NULL };
+  ihex8ReceiveWith(&ih, &handler);
+
+  static uint8_t buffer[IHEX8_MAX_LENGTH];
+  IHex8Record record = { NULL, 0, 0, IHEX8_DATA, buffer };
+  mio_rewind(&mio);
+  handler.record = &record;
+  ihex8ReceiveWith(&ih, &handler);
+
+  IHex8Handler streaming = { NULL, run_command, &sum, NULL, 
+      claim_page, commit_page, discard_page, verify_pages };
+  mio_rewind(&mio);
+  ihex8ReceiveWith(&ih, &streaming);
+
+  mio_cleanup(&mio);
+  return 0;
+}
+
+/* compressed records must decode back to the image they came from */
+void check_compress(IHex8Image* image) {
+  mio_s out;
+  IHex8 ih;
+  IHex8Record* rex = ihex8ImageRecords(image, IHEX8_LZ_BLOCK);
+  if (ihex8Compress(rex) < 0) abort();
+  mio_init(&out, NULL, 0);
+  mio_ihex8(&out, &ih);
+  ihex8Dump(rex, &ih);
+  ihex8Free(rex);
+
+  mio_s in;
+  mio_init(&in, out.out, out.outlen);
+  mio_ihex8(&in, &ih);
+  IHex8Image* copy = ihex8LoadImage(&ih, image->pageBits);
+  if (copy == NULL) abort();
+  for (long address = 0; address < 0x10000; address++) {
+    if (ihex8ImageGet(copy, address) != ihex8ImageGet(image, address)) abort();
+  }
+  ihex8ImageFree(copy);
+  mio_cleanup(&in);
+  mio_cleanup(&out);
+}
+
+void store_record(IHex8Record* rec, void* ctx) {
+  unsigned long* sum = (unsigned long*) ctx;
+  for (int i = 0; i < rec->length; i++) {
+    *sum += rec->data[i];
+  }
+}
+
+int run_command(char* line, char* reply, int replylen, void* ctx) {
+  snprintf(reply, replylen, "%s", line);
+  return line[0] == '\0' ? -1 : 0;
+}
+
+uint8_t* claim_page(uint16_t address, uint8_t* length, void* ctx) {
+  static uint8_t page[64];
+  uint8_t offset = address & 63;
+  if (*length > 64 - offset) *length = 64 - offset;
+  return page + offset;
+}
+
+void commit_page(void* ctx) {
+  (*(unsigned long*) ctx)++;
+}
+
+void discard_page(void* ctx) {
+}
+
+const char* verify_pages(uint8_t final, void* ctx) {
+  /* fail now and then to cover the abort after an acked write */
+  return (*(unsigned long*) ctx & 0x3F) == 0x2A ? "verify failed" : NULL;
+}
+
+#ifdef FUZZ_STANDALONE
+/* 
+ * Reads each named file (or stdin) as one input, for AFL and for 
+ * replaying crashes without libFuzzer.
+ */
+int main(int argc, char* argv[]) {
+  static uint8_t buf[1<<20];
+  int files = argc > 1 ? argc - 1 : 1;
+  for (int i = 0; i < files; i++) {
+    FILE* fp = argc > 1 ? fopen(argv[i + 1], "rb") : stdin;
+    if (fp == NULL) {
+      perror(argv[i + 1]);
+      return 1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf), fp);
+    if (fp != stdin) fclose(fp);
+    LLVMFuzzerTestOneInput(buf, n);
+  }
+  return 0;
+}
+#endif
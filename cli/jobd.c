@@ -0,0 +1,299 @@
+/*
+ * jobd.c *
+ * burn job queue on a unix domain socket
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "jobd.h"
+
+#define JOBD_REQUEST "JOB"
+#define JOBD_EXIT "EXIT"
+
+typedef struct
+{
+  jobd_s *jobd;
+  int fd;
+} connection_s;
+
+static void *accept_jobs(void *arg);
+static void *queue_job(void *arg);
+static job_s *read_job(int fd, const char **error);
+static int write_all(int fd, const char *buf, size_t count);
+static int unix_address(struct sockaddr_un *addr, const char *path);
+
+int jobd_init(jobd_s *jobd)
+{
+  memset(jobd, 0, sizeof(jobd_s));
+  jobd->fd = -1;
+  pthread_mutex_init(&jobd->lock, NULL);
+  pthread_cond_init(&jobd->ready, NULL);
+  return 0;
+}
+
+void jobd_cleanup(jobd_s *jobd)
+{
+  if (jobd->fd != -1) {
+    close(jobd->fd);
+    unlink(jobd->path);
+    jobd->fd = -1;
+  }
+  pthread_cond_destroy(&jobd->ready);
+  pthread_mutex_destroy(&jobd->lock);
+}
+
+int jobd_open(jobd_s *jobd)
+{
+  struct sockaddr_un addr;
+  if (unix_address(&addr, jobd->path) != 0) return -1;
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    perror("socket");
+    return -1;
+  }
+  unlink(jobd->path);
+  if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    perror("bind");
+    close(fd);
+    return -1;
+  }
+  if (listen(fd, 8) == -1) {
+    perror("listen");
+    close(fd);
+    return -1;
+  }
+
+  /* a client that goes away mid-job must not take the daemon with it */
+  signal(SIGPIPE, SIG_IGN);
+
+  jobd->fd = fd;
+  if (pthread_create(&jobd->acceptor, NULL, accept_jobs, jobd) != 0) {
+    perror("pthread_create");
+    jobd_cleanup(jobd);
+    return -1;
+  }
+  pthread_detach(jobd->acceptor);
+  return 0;
+}
+
+job_s *jobd_next(jobd_s *jobd)
+{
+  pthread_mutex_lock(&jobd->lock);
+  while (jobd->head == NULL) {
+    pthread_cond_wait(&jobd->ready, &jobd->lock);
+  }
+  job_s *job = jobd->head;
+  jobd->head = job->next;
+  if (jobd->head == NULL) jobd->tail = NULL;
+  pthread_mutex_unlock(&jobd->lock);
+  return job;
+}
+
+void jobd_finish(jobd_s *jobd, job_s *job, int rc)
+{
+  dprintf(job->fd, "%s %d\n", JOBD_EXIT, rc);
+  close(job->fd);
+
+  pthread_mutex_lock(&jobd->lock);
+  jobd->queued--;
+  pthread_mutex_unlock(&jobd->lock);
+
+  free(job->data);
+  free(job);
+}
+
+int jobd_submit(const char *path, int argc, const char *argv[], FILE *in, FILE *out)
+{
+  struct sockaddr_un addr;
+  char line[JOBD_MAX_LINE];
+  if (unix_address(&addr, path) != 0) return 1;
+
+  int n = snprintf(line, sizeof(line), "%s", JOBD_REQUEST);
+  for (int i = 1; i < argc; i++) {
+    if (strpbrk(argv[i], " \t\n") != NULL) {
+      fprintf(stderr, "argument cannot be queued: '%s'\n", argv[i]);
+      return 1;
+    }
+    n += snprintf(line + n, sizeof(line) - n, " %s", argv[i]);
+    if (n >= (int) sizeof(line) - 1) {
+      fputs("too many arguments to queue\n", stderr);
+      return 1;
+    }
+  }
+  line[n++] = '\n';
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    perror("socket");
+    return 1;
+  }
+  if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) {
+    perror(path);
+    close(fd);
+    return 1;
+  }
+
+  char buf[4096];
+  size_t count;
+  int rc = write_all(fd, line, n);
+  while (rc == 0 && (count = fread(buf, 1, sizeof(buf), in)) > 0) {
+    rc = write_all(fd, buf, count);
+  }
+  if (rc != 0) perror(path);
+  shutdown(fd, SHUT_WR);
+
+  /* everything up to the exit line is the job's own output */
+  FILE *status = fdopen(fd, "r");
+  rc = 1;
+  while (fgets(line, sizeof(line), status) != NULL) {
+    if (strncmp(line, JOBD_EXIT " ", strlen(JOBD_EXIT) + 1) == 0) {
+      rc = atoi(line + strlen(JOBD_EXIT) + 1);
+      break;
+    }
+    fputs(line, out);
+    fflush(out);
+  }
+  fclose(status);
+  return rc;
+}
+
+static void *accept_jobs(void *arg)
+{
+  jobd_s *jobd = (jobd_s *) arg;
+  while (1) {
+    int fd = accept(jobd->fd, NULL, NULL);
+    if (fd == -1) {
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      perror("accept");
+      return NULL;
+    }
+
+    /* a client may take its time sending, so each is read on its own */
+    connection_s *conn = (connection_s *) malloc(sizeof(connection_s));
+    pthread_t reader;
+    if (conn != NULL) {
+      conn->jobd = jobd;
+      conn->fd = fd;
+    }
+    if (conn == NULL || pthread_create(&reader, NULL, queue_job, conn) != 0) {
+      dprintf(fd, "error: daemon out of resources\n%s 1\n", JOBD_EXIT);
+      close(fd);
+      free(conn);
+      continue;
+    }
+    pthread_detach(reader);
+  }
+}
+
+static void *queue_job(void *arg)
+{
+  connection_s *conn = (connection_s *) arg;
+  jobd_s *jobd = conn->jobd;
+  int fd = conn->fd;
+  free(conn);
+
+  const char *error = "bad job request";
+  job_s *job = read_job(fd, &error);
+  if (job == NULL) {
+    dprintf(fd, "error: %s\n%s 1\n", error, JOBD_EXIT);
+    close(fd);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&jobd->lock);
+  job->id = ++jobd->jobs;
+  dprintf(fd, "Queued as job %d, %d ahead\n", job->id, jobd->queued);
+  jobd->queued++;
+  if (jobd->tail != NULL) {
+    jobd->tail->next = job;
+  }
+  else {
+    jobd->head = job;
+  }
+  jobd->tail = job;
+  pthread_cond_signal(&jobd->ready);
+  pthread_mutex_unlock(&jobd->lock);
+  return NULL;
+}
+
+static job_s *read_job(int fd, const char **error)
+{
+  job_s *job = (job_s *) calloc(1, sizeof(job_s));
+  if (job == NULL) return NULL;
+  job->fd = fd;
+
+  size_t capacity = 4096;
+  job->data = (char *) malloc(capacity);
+  while (job->data != NULL) {
+    if (job->size == capacity) {
+      if (capacity >= JOBD_MAX_INPUT) {
+        *error = "hex file too large to queue";
+        break;
+      }
+      capacity *= 2;
+      char *data = (char *) realloc(job->data, capacity);
+      if (data == NULL) break;
+      job->data = data;
+    }
+    ssize_t n = read(fd, job->data + job->size, capacity - job->size);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) break;
+    if (n == 0) {
+      /* client closed its side: split off the argument line */
+      char *eol = memchr(job->data, '\n', job->size);
+      if (eol == NULL || eol - job->data >= JOBD_MAX_LINE) break;
+      memcpy(job->line, job->data, eol - job->data);
+      job->size -= eol - job->data + 1;
+      memmove(job->data, eol + 1, job->size);
+
+      char *save;
+      char *arg = strtok_r(job->line, " ", &save);
+      if (arg == NULL || strcmp(arg, JOBD_REQUEST) != 0) break;
+      while (arg != NULL && job->argc < JOBD_MAX_ARGS) {
+        job->argv[job->argc++] = arg;
+        arg = strtok_r(NULL, " ", &save);
+      }
+      if (arg != NULL) break;
+      return job;
+    }
+    job->size += n;
+  }
+
+  free(job->data);
+  free(job);
+  return NULL;
+}
+
+static int write_all(int fd, const char *buf, size_t count)
+{
+  while (count > 0) {
+    /* the daemon hangs up on a job it refuses; say so rather than die */
+    ssize_t n = send(fd, buf, count, MSG_NOSIGNAL);
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    buf += n;
+    count -= n;
+  }
+  return 0;
+}
+
+static int unix_address(struct sockaddr_un *addr, const char *path)
+{
+  memset(addr, 0, sizeof(*addr));
+  addr->sun_family = AF_UNIX;
+  if (strlen(path) >= sizeof(addr->sun_path)) {
+    fprintf(stderr, "socket path too long: %s\n", path);
+    return -1;
+  }
+  strcpy(addr->sun_path, path);
+  return 0;
+}
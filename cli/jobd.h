@@ -0,0 +1,45 @@
+#ifndef jobd_h
+#define jobd_h
+
+#include <stdio.h>
+#include <pthread.h>
+
+#define JOBD_MAX_ARGS 32
+#define JOBD_MAX_LINE 1024
+#define JOBD_MAX_INPUT (1L << 20)
+
+typedef struct job_t
+{
+	struct job_t *next;
+	int id;
+	int fd;				/* client connection and status stream */
+	int argc;
+	char *argv[JOBD_MAX_ARGS + 1];
+	char line[JOBD_MAX_LINE];	/* argv points into this */
+	char *data;			/* hex file sent by the client */
+	size_t size;
+} job_s;
+
+typedef struct
+{
+	const char *path;
+	int fd;
+	int jobs;
+	int queued;
+	job_s *head;
+	job_s *tail;
+	pthread_mutex_t lock;
+	pthread_cond_t ready;
+	pthread_t acceptor;
+} jobd_s;
+
+int jobd_init(jobd_s *jobd);
+void jobd_cleanup(jobd_s *jobd);
+
+int jobd_open(jobd_s *jobd);
+job_s *jobd_next(jobd_s *jobd);
+void jobd_finish(jobd_s *jobd, job_s *job, int rc);
+
+int jobd_submit(const char *path, int argc, const char *argv[], FILE *in, FILE *out);
+
+#endif	/* jobd_h */
@@ -0,0 +1,351 @@
+/*
+ * load.c *
+ * parse a large hex file on every core
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "load.h"
+#include "cache.h"
+
+#define CHUNK_DONE 0		/* parsed to its end */
+#define CHUNK_END 1		/* stopped at the end of file record */
+#define CHUNK_ERROR 2
+#define CHUNK_UNSUPPORTED 3	/* holds records only the usual parser knows */
+
+typedef struct
+{
+  const char *start;
+  const char *end;
+  uint8_t page_bits;
+  IHex8Image *image;
+  int status;
+  const char *error;
+  long lines;		/* newlines before where it stopped */
+  long overlaps;
+  int first;		/* address of the first overlapping record, or -1 */
+  const char *first_at;	/* and where it starts */
+} chunk_s;
+
+static void *parse_chunk(void *arg);
+static int parse_record(chunk_s *c, const char **p, IHex8Record *rec);
+static int chunk_fail(chunk_s *c, const char *error);
+static int hex_byte(const char **p, const char *end);
+static const char *next_record(const char *p, const char *end);
+static int first_overlap(IHex8Image *image, chunk_s *c);
+static int images_meet(IHex8Image *a, IHex8Image *b);
+
+int load_buffer(const char *text, size_t size, uint8_t page_bits, int threads,
+    FILE *err, IHex8Image **image)
+{
+  chunk_s chunks[LOAD_THREADS_MAX];
+  pthread_t workers[LOAD_THREADS_MAX];
+  *image = NULL;
+
+  /* cut where a line starts a record; a record never spans a newline,
+   * so every chunk starts in step with the parser */
+  int n = size / LOAD_CHUNK_MIN;
+  if (n > threads) n = threads;
+  if (n > LOAD_THREADS_MAX) n = LOAD_THREADS_MAX;
+  if (n < 1) n = 1;
+  const char *end = text + size;
+  const char *p = text;
+  int count = 0;
+  for (int i = 0; i < n && p < end; i++) {
+    const char *next = i + 1 < n ? next_record(text + size / n * (i + 1), end) : end;
+    if (next < p) next = p;
+    memset(&chunks[count], 0, sizeof(chunk_s));
+    chunks[count].start = p;
+    chunks[count].end = next;
+    chunks[count].page_bits = page_bits;
+    chunks[count].first = -1;
+    count++;
+    p = next;
+  }
+
+  int started = 0;
+  for (; started < count - 1; started++) {
+    if (pthread_create(&workers[started], NULL, parse_chunk, &chunks[started]) != 0) break;
+  }
+  for (int i = started; i < count; i++) {
+    parse_chunk(&chunks[i]);
+  }
+  for (int i = 0; i < started; i++) {
+    pthread_join(workers[i], NULL);
+  }
+
+  /* the first chunk that stopped decides, as it would have reading in order */
+  int rc = LOAD_FAILED;
+  long line = 1;
+  long overlaps = 0;
+  int first = -1;
+  int last = 0;
+  for (; last < count; last++) {
+    chunk_s *c = &chunks[last];
+    line += c->lines;
+    if (c->status == CHUNK_DONE) continue;
+    if (c->status == CHUNK_END) rc = LOAD_OK;
+    if (c->status == CHUNK_ERROR) {
+      fprintf(err, "error: line %ld: %s\n", line, c->error);
+    }
+    if (c->status == CHUNK_UNSUPPORTED) rc = LOAD_UNSUITABLE;
+    break;
+  }
+  if (last == count) {
+    fprintf(err, "error: line %ld: expected start of record\n", line);
+  }
+
+  if (rc == LOAD_OK) {
+    *image = chunks[0].image;
+    chunks[0].image = NULL;
+    for (int i = 0; i <= last; i++) {
+      chunk_s *c = &chunks[i];
+      if (i > 0) {
+        /* an overlap in an earlier chunk comes first in the file */
+        if (first == -1) first = first_overlap(*image, c);
+        long merged = ihex8ImageMerge(*image, c->image);
+        if (merged < 0) {
+          fputs("error: out of memory\n", err);
+          rc = LOAD_FAILED;
+          break;
+        }
+        overlaps += merged;
+      }
+      if (first == -1) first = c->first;
+      overlaps += c->overlaps;
+    }
+  }
+  for (int i = 0; i < count; i++) {
+    ihex8ImageFree(chunks[i].image);
+  }
+  if (rc != LOAD_OK) {
+    ihex8ImageFree(*image);
+    *image = NULL;
+    return rc;
+  }
+
+  if (overlaps > 0) {
+    fprintf(err, "warning: %ld byte(s) overlap earlier records, first at %04X\n",
+        overlaps, first);
+  }
+  return LOAD_OK;
+}
+
+int load_mapped(FILE *fp, uint8_t page_bits, FILE *err, IHex8Image **image)
+{
+  /* only a regular file big enough to split is worth mapping */
+  struct stat st;
+  int fd = fileno(fp);
+  long offset = ftell(fp);
+  if (fd == -1 || offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return LOAD_UNSUITABLE;
+  }
+  if (st.st_size - offset < 2 * LOAD_CHUNK_MIN) return LOAD_UNSUITABLE;
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) return LOAD_UNSUITABLE;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  int rc = load_buffer((const char *) map + offset, st.st_size - offset, page_bits,
+      load_threads(), err, image);
+  munmap(map, st.st_size);
+  if (rc != LOAD_UNSUITABLE) fseek(fp, 0, SEEK_END);
+  return rc;
+}
+
+int load_threads(void)
+{
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if (n < 1) return 1;
+  return n > LOAD_THREADS_MAX ? LOAD_THREADS_MAX : (int) n;
+}
+
+int load_key(FILE *fp, uint8_t page_bits, char *key, size_t size)
+{
+  /* names the image the rest of a file parses to, without parsing it */
+  struct stat st;
+  int fd = fileno(fp);
+  long offset = ftell(fp);
+  if (fd == -1 || offset < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return -1;
+  if (st.st_size <= offset) return -1;
+
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (map == MAP_FAILED) return -1;
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+  uint64_t hash = cache_hash((const char *) map + offset, st.st_size - offset, CACHE_HASH_SEED);
+  munmap(map, st.st_size);
+
+  int length = snprintf(key, size, "%016llx-%u", (unsigned long long) hash, page_bits);
+  return length < 0 || (size_t) length >= size ? -1 : 0;
+}
+
+static void *parse_chunk(void *arg)
+{
+  chunk_s *c = (chunk_s *) arg;
+  uint8_t data[IHEX8_MAX_LENGTH];
+  IHex8Record rec = { NULL, 0, 0, IHEX8_DATA, data };
+  c->image = ihex8ImageCreate(c->page_bits);
+  if (c->image == NULL) {
+    chunk_fail(c, "out of memory");
+    return NULL;
+  }
+
+  const char *p = c->start;
+  while (1) {
+    /* the same whitespace the usual parser skips between records */
+    while (p < c->end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+      if (*p++ == '\n') c->lines++;
+    }
+    if (p == c->end) {
+      c->status = CHUNK_DONE;
+      return NULL;
+    }
+
+    const char *at = p;
+    int type = parse_record(c, &p, &rec);
+    if (type == -1) return NULL;
+    if (type == IHEX8_EOF) {
+      c->status = CHUNK_END;
+      return NULL;
+    }
+    if (rec.length == 0) continue;
+
+    long overlaps = ihex8ImageStore(c->image, &rec);
+    if (overlaps < 0) {
+      chunk_fail(c, "out of memory");
+      return NULL;
+    }
+    if (overlaps > 0 && c->first == -1) {
+      c->first = rec.address;
+      c->first_at = at;
+    }
+    c->overlaps += overlaps;
+  }
+}
+
+static int parse_record(chunk_s *c, const char **p, IHex8Record *rec)
+{
+  /* mirrors readRecord in ihex8.c, including what it calls an error */
+  if (**p == CMD_START) return chunk_fail(c, "unexpected command");
+  if (**p != ':') return chunk_fail(c, "expected start of record");
+  (*p)++;
+
+  int length = hex_byte(p, c->end);
+  if (length == -1) return chunk_fail(c, "expected record length");
+  int msb = hex_byte(p, c->end);
+  int lsb = msb != -1 ? hex_byte(p, c->end) : -1;
+  if (lsb == -1) return chunk_fail(c, "expected address");
+  int type = hex_byte(p, c->end);
+  if (type == -1) return chunk_fail(c, "expected record type");
+  if (type == IHEX8_LZ) {
+    c->status = CHUNK_UNSUPPORTED;
+    return -1;
+  }
+  if (type != IHEX8_DATA && type != IHEX8_EOF) {
+    return chunk_fail(c, "unsupported record type");
+  }
+
+  rec->address = (msb << 8) | lsb;
+  rec->length = 0;
+  int sum = length + msb + lsb + type;
+  if (type == IHEX8_DATA && length > 0) {
+    for (int i = 0; i < length; i++) {
+      int b = hex_byte(p, c->end);
+      if (b == -1) return chunk_fail(c, "expected data byte");
+      rec->data[i] = (uint8_t) b;
+      sum += b;
+    }
+    int checksum = hex_byte(p, c->end);
+    if (checksum == -1) return chunk_fail(c, "expected checksum");
+    if (((sum + checksum) & 0xff) != 0) return chunk_fail(c, "checksum mismatch");
+    rec->length = length;
+  }
+  if (type == IHEX8_EOF && hex_byte(p, c->end) != 0xff) {
+    return chunk_fail(c, "checksum mismatch");
+  }
+
+  if (*p < c->end && **p == '\r') (*p)++;
+  if (*p == c->end || **p != '\n') return chunk_fail(c, "expected end of record");
+  (*p)++;
+  c->lines++;
+  return type;
+}
+
+static int chunk_fail(chunk_s *c, const char *error)
+{
+  c->status = CHUNK_ERROR;
+  c->error = error;
+  return -1;
+}
+
+static int hex_byte(const char **p, const char *end)
+{
+  static const int8_t nibble[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16
+  };
+  if (end - *p < 2) return -1;
+  int hi = nibble[(uint8_t) (*p)[0]];
+  int lo = nibble[(uint8_t) (*p)[1]];
+  if (hi == 0 || lo == 0) return -1;
+  *p += 2;
+  return (hi - 1) << 4 | (lo - 1);
+}
+
+static const char *next_record(const char *p, const char *end)
+{
+  while (p < end) {
+    const char *eol = memchr(p, '\n', end - p);
+    if (eol == NULL) return end;
+    p = eol + 1;
+    if (p < end && *p == ':') return p;
+  }
+  return end;
+}
+
+static int first_overlap(IHex8Image *image, chunk_s *c)
+{
+  /* the usual parser names the first record in the file that lands on
+   * bytes already read; those of earlier chunks are in image, so when
+   * any are touched, read the chunk again up to its own first overlap */
+  if (!images_meet(image, c->image)) return c->first;
+
+  chunk_s scan = *c;
+  uint8_t data[IHEX8_MAX_LENGTH];
+  IHex8Record rec = { NULL, 0, 0, IHEX8_DATA, data };
+  const char *p = c->start;
+  while (p < c->end && (c->first_at == NULL || p < c->first_at)) {
+    if (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+      p++;
+      continue;
+    }
+    int type = parse_record(&scan, &p, &rec);
+    if (type == -1 || type == IHEX8_EOF) break;
+    for (int i = 0; i < rec.length; i++) {
+      if (ihex8ImageGet(image, (uint16_t) (rec.address + i)) != -1) return rec.address;
+    }
+  }
+  return c->first;
+}
+
+static int images_meet(IHex8Image *a, IHex8Image *b)
+{
+  uint16_t size = 1U << b->pageBits;
+  IHex8Page *page = NULL;
+  while ((page = ihex8ImageNext(b, page)) != NULL) {
+    IHex8Page *other = a->pages[page->address];
+    if (other == NULL) continue;
+    for (uint16_t i = 0; i < (size + 7) / 8; i++) {
+      if (page->present[i] & other->present[i]) return 1;
+    }
+  }
+  return 0;
+}
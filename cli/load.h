@@ -0,0 +1,22 @@
+#ifndef load_h
+#define load_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../ihex8.h"
+
+#define LOAD_OK 0
+#define LOAD_FAILED -1		/* reported on err */
+#define LOAD_UNSUITABLE 1	/* nothing read, parse it the usual way */
+
+#define LOAD_CHUNK_MIN (64 * 1024)	/* smaller inputs are not split */
+#define LOAD_THREADS_MAX 16
+#define LOAD_KEY_SIZE 32
+
+int load_buffer(const char *text, size_t size, uint8_t page_bits, int threads,
+    FILE *err, IHex8Image **image);
+int load_mapped(FILE *fp, uint8_t page_bits, FILE *err, IHex8Image **image);
+int load_threads(void);
+int load_key(FILE *fp, uint8_t page_bits, char *key, size_t size);
+
+#endif	/* load_h */
@@ -0,0 +1,216 @@
+/*
+ * metrics.c *
+ * burn timing and throughput
+ *
+ */ 
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "metrics.h"
+
+static const char *phase_names[PHASE_COUNT] = {
+  "parse", "sync", "erase", "send", "write", "verify"
+};
+
+static void on_sent(IHex8Record *rec, void *ctx);
+static void on_acked(IHex8Record *rec, void *ctx);
+static void on_nacked(IHex8Record *rec, void *ctx);
+static long flight_key(IHex8Record *rec);
+static int flight_slot(metrics_s *m, long key);
+static double bucket_limit(int i);
+
+int metrics_init(metrics_s *m)
+{
+  memset(m, 0, sizeof(metrics_s));
+  m->latency_min = -1;
+  for (int i = 0; i < METRICS_FLIGHT; i++) {
+    m->flight[i] = -1;
+  }
+  m->progress = NULL;
+  return 0;
+}
+
+double metrics_now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void metrics_begin(metrics_s *m, phase_e phase)
+{
+  m->started[phase] = metrics_now();
+}
+
+void metrics_end(metrics_s *m, phase_e phase)
+{
+  if (m->started[phase] == 0) return;
+  m->elapsed[phase] += metrics_now() - m->started[phase];
+  m->started[phase] = 0;
+  if (phase == PHASE_SEND && m->progress != NULL) {
+    metrics_show(m, 1);
+    fputc('\n', m->progress);
+  }
+}
+
+void metrics_expect(metrics_s *m, IHex8Record *rex)
+{
+  m->total_records = m->records;
+  m->total_bytes = m->bytes;
+  for (; rex != NULL; rex = rex->next) {
+    m->total_records++;
+    m->total_bytes += rex->length;
+  }
+}
+
+void metrics_monitor(metrics_s *m, IHex8Monitor *monitor)
+{
+  monitor->sent = on_sent;
+  monitor->acked = on_acked;
+  monitor->nacked = on_nacked;
+  monitor->ctx = m;
+}
+
+void metrics_show(metrics_s *m, int force)
+{
+  if (m->progress == NULL) return;
+
+  double now = metrics_now();
+  if (!force && now - m->shown_at < 0.1) return;
+  m->shown_at = now;
+
+  double elapsed = m->elapsed[PHASE_SEND];
+  if (m->started[PHASE_SEND] != 0) elapsed += now - m->started[PHASE_SEND];
+  double rate = elapsed > 0 ? m->bytes / elapsed : 0;
+  long remaining = m->total_bytes - m->bytes;
+  long eta = rate > 0 && remaining > 0 ? (long) (remaining / rate) : 0;
+  int pct = m->total_bytes > 0 ? (int) (100 * m->bytes / m->total_bytes) : 100;
+
+  fprintf(m->progress, "\r%6ld/%ld bytes %3d%% %8.1f B/s ETA %ld:%02ld", 
+      m->bytes, m->total_bytes, pct, rate, eta / 60, eta % 60);
+  if (m->retransmits > 0) {
+    fprintf(m->progress, " (%ld retransmitted)", m->retransmits);
+  }
+  fflush(m->progress);
+}
+
+void metrics_report(metrics_s *m, int format, int ok, FILE *f)
+{
+  double send = m->elapsed[PHASE_SEND];
+  double rate = send > 0 ? m->bytes / send : 0;
+  double mean = m->acks > 0 ? m->latency_sum / m->acks : 0;
+  double min = m->latency_min < 0 ? 0 : m->latency_min;
+
+  if (format == METRICS_JSON) {
+    fprintf(f, "{\"ok\":%s,\"phases\":{", ok ? "true" : "false");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+      fprintf(f, "%s\"%s\":%.6f", i ? "," : "", phase_names[i], m->elapsed[i]);
+    }
+    fprintf(f, "},\"records\":%ld,\"bytes\":%ld,\"retransmits\":%ld,"
+        "\"bytes_per_second\":%.1f,", m->records, m->bytes, m->retransmits, rate);
+    fprintf(f, "\"ack_latency_ms\":{\"count\":%ld,\"min\":%.3f,\"mean\":%.3f,"
+        "\"max\":%.3f,\"histogram\":[", m->acks, min, mean, m->latency_max);
+    for (int i = 0; i < METRICS_BUCKETS; i++) {
+      if (i < METRICS_BUCKETS - 1) {
+        fprintf(f, "%s{\"le\":%g,\"count\":%ld}", i ? "," : "", 
+            bucket_limit(i), m->histogram[i]);
+      }
+      else {
+        fprintf(f, ",{\"le\":null,\"count\":%ld}", m->histogram[i]);
+      }
+    }
+    fputs("]}}\n", f);
+    return;
+  }
+
+  fputs("phase      seconds\n", f);
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    fprintf(f, "%-8s %9.3f\n", phase_names[i], m->elapsed[i]);
+  }
+  fprintf(f, "%ld records, %ld bytes, %ld retransmitted, %.1f B/s\n", 
+      m->records, m->bytes, m->retransmits, rate);
+  fprintf(f, "ack latency ms: min %.3f mean %.3f max %.3f\n", 
+      min, mean, m->latency_max);
+  for (int i = 0; i < METRICS_BUCKETS; i++) {
+    if (m->histogram[i] == 0) continue;
+    if (i < METRICS_BUCKETS - 1) {
+      fprintf(f, "  < %5g ms %8ld\n", bucket_limit(i), m->histogram[i]);
+    }
+    else {
+      fprintf(f, "  >=%5g ms %8ld\n", bucket_limit(i - 1), m->histogram[i]);
+    }
+  }
+}
+
+static void on_sent(IHex8Record *rec, void *ctx)
+{
+  metrics_s *m = (metrics_s *) ctx;
+  int i = flight_slot(m, flight_key(rec));
+  if (i < 0) {
+    /* more in flight than the window allows; drop the oldest send */
+    i = 0;
+    for (int j = 1; j < METRICS_FLIGHT; j++) {
+      if (m->sent_at[j] < m->sent_at[i]) i = j;
+    }
+  }
+  m->flight[i] = flight_key(rec);
+  m->sent_at[i] = metrics_now();
+}
+
+static void on_acked(IHex8Record *rec, void *ctx)
+{
+  /* with several records in flight, time the ack against its own send */
+  metrics_s *m = (metrics_s *) ctx;
+  int sent = flight_slot(m, flight_key(rec));
+  if (sent >= 0 && m->flight[sent] != -1) {
+    double latency = (metrics_now() - m->sent_at[sent]) * 1e3;
+    m->flight[sent] = -1;
+
+    int i = 0;
+    while (i < METRICS_BUCKETS - 1 && latency >= bucket_limit(i)) i++;
+    m->histogram[i]++;
+
+    if (m->latency_min < 0 || latency < m->latency_min) m->latency_min = latency;
+    if (latency > m->latency_max) m->latency_max = latency;
+    m->latency_sum += latency;
+    m->acks++;
+  }
+
+  if (rec != NULL) {
+    m->records++;
+    m->bytes += rec->length;
+  }
+  metrics_show(m, 0);
+}
+
+static void on_nacked(IHex8Record *rec, void *ctx)
+{
+  /* the resend is timed afresh */
+  metrics_s *m = (metrics_s *) ctx;
+  int i = flight_slot(m, flight_key(rec));
+  if (i >= 0) m->flight[i] = -1;
+  m->retransmits++;
+}
+
+static long flight_key(IHex8Record *rec)
+{
+  /* records in flight are told apart by address, end of file by none */
+  return rec != NULL ? rec->address : 0x10000;
+}
+
+static int flight_slot(metrics_s *m, long key)
+{
+  /* the entry sent for key, else a free one, else -1 */
+  int free = -1;
+  for (int i = 0; i < METRICS_FLIGHT; i++) {
+    if (m->flight[i] == key) return i;
+    if (m->flight[i] == -1 && free < 0) free = i;
+  }
+  return free;
+}
+
+static double bucket_limit(int i)
+{
+  return (double) (1L << i);
+}
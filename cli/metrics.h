@@ -0,0 +1,55 @@
+#ifndef metrics_h 
+#define metrics_h
+
+#include <stdio.h>
+#include "../ihex8.h"
+
+#define METRICS_BUCKETS 16
+#define METRICS_FLIGHT IHEX8_WINDOW_MAX
+
+#define METRICS_NONE 0
+#define METRICS_TEXT 1
+#define METRICS_JSON 2
+
+typedef enum
+{
+	PHASE_PARSE,
+	PHASE_SYNC,
+	PHASE_ERASE,
+	PHASE_SEND,
+	PHASE_WRITE,
+	PHASE_VERIFY,
+	PHASE_COUNT
+} phase_e;
+
+typedef struct
+{
+	double started[PHASE_COUNT];
+	double elapsed[PHASE_COUNT];
+	long total_records;
+	long total_bytes;
+	long records;
+	long bytes;
+	long retransmits;
+	long acks;
+	long flight[METRICS_FLIGHT];		/* addresses awaiting acks, or -1 */
+	double sent_at[METRICS_FLIGHT];		/* and when each was last sent */
+	double latency_min;
+	double latency_max;
+	double latency_sum;
+	long histogram[METRICS_BUCKETS];	/* ack latency, bucket i < 2^i ms */
+	double shown_at;
+	FILE *progress;
+} metrics_s;
+
+int metrics_init(metrics_s *m);
+
+double metrics_now(void);
+void metrics_begin(metrics_s *m, phase_e phase);
+void metrics_end(metrics_s *m, phase_e phase);
+void metrics_expect(metrics_s *m, IHex8Record *rex);
+void metrics_monitor(metrics_s *m, IHex8Monitor *monitor);
+void metrics_show(metrics_s *m, int force);
+void metrics_report(metrics_s *m, int format, int ok, FILE *f);
+
+#endif	/* metrics_h */
@@ -0,0 +1,127 @@
+/*
+ * mio.c *
+ * memory port routines
+ *
+ */ 
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mio.h"
+
+static int ihex8_readc(void *ctx);
+static int ihex8_readln(void *ctx, char *buf, int buflen);
+static int ihex8_writec(void *ctx, char c);
+static int ihex8_writeln(void *ctx, const char *s);
+
+int mio_init(mio_s *mio, const char *in, size_t inlen)
+{
+  mio->in = in;
+  mio->inlen = inlen;
+  mio->inpos = 0;
+  mio->out = NULL;
+  mio->outlen = 0;
+  mio->outcap = 0;
+  return 0;
+}
+
+void mio_cleanup(mio_s *mio)
+{
+  free(mio->out);
+  mio->out = NULL;
+  mio->outlen = 0;
+  mio->outcap = 0;
+}
+
+void mio_rewind(mio_s *mio)
+{
+  mio->inpos = 0;
+  mio->outlen = 0;
+}
+
+int mio_read(mio_s *mio, void *buf, size_t count)
+{
+  size_t n = mio->inlen - mio->inpos;
+  if (n > count) n = count;
+  memcpy(buf, mio->in + mio->inpos, n);
+  mio->inpos += n;
+  return n;
+}
+
+int mio_read_line(mio_s *mio, void *buf, size_t count)
+{
+  char *p = buf;
+  size_t length = 0;
+
+  if (count == 0) return 0;
+  if (mio->inpos == mio->inlen) return -1;
+
+  while (length < count - 1 && mio->inpos < mio->inlen) {
+    char c = mio->in[mio->inpos++];
+    if (c == '\n') break;
+    if (c != '\r') {
+      *p++ = c;
+      length++;
+    }
+  }
+  *p = '\0';
+  return length;
+}
+
+int mio_write(mio_s *mio, const void *buf, size_t count)
+{
+  if (mio->outlen + count > mio->outcap) {
+    size_t cap = mio->outcap ? 2*mio->outcap : 4096;
+    while (cap < mio->outlen + count) cap *= 2;
+    char *out = realloc(mio->out, cap);
+    if (out == NULL) return -1;
+    mio->out = out;
+    mio->outcap = cap;
+  }
+  memcpy(mio->out + mio->outlen, buf, count);
+  mio->outlen += count;
+  return count;
+}
+
+void mio_debug(mio_s *mio, FILE *f)
+{
+  fprintf(f, "mio {\n");
+  fprintf(f, "\tinlen = %zu\n", mio->inlen);  
+  fprintf(f, "\tinpos = %zu\n", mio->inpos);  
+  fprintf(f, "\toutlen = %zu\n", mio->outlen);  
+  fprintf(f, "}\n\n");
+}
+
+void mio_ihex8(mio_s *mio, IHex8 *ih)
+{
+  ih->readc = ihex8_readc;
+  ih->readln = ihex8_readln;
+  ih->writec = ihex8_writec;
+  ih->writeln = ihex8_writeln;
+  ih->ctx = mio;
+  ih->report = NULL;
+}
+
+static int ihex8_readc(void *ctx)
+{
+  char c;
+  return mio_read((mio_s *) ctx, &c, 1) == 1 ? (unsigned char) c : -1;
+}
+
+static int ihex8_readln(void *ctx, char *buf, int buflen)
+{
+  return mio_read_line((mio_s *) ctx, buf, buflen);
+}
+
+static int ihex8_writec(void *ctx, char c)
+{
+  return mio_write((mio_s *) ctx, &c, 1);
+}
+
+static int ihex8_writeln(void *ctx, const char *s)
+{
+  int rc = mio_write((mio_s *) ctx, s, strlen(s));
+  if (rc == -1) return -1;
+  if (ihex8_writec(ctx, '\n') == -1) return -1;
+  return rc + 1;
+}
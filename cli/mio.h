@@ -0,0 +1,27 @@
+#ifndef mio_h 
+#define mio_h
+
+#include <stdio.h>
+#include "../ihex8.h"
+
+typedef struct
+{
+	const char *in;
+	size_t inlen;
+	size_t inpos;
+	char *out;
+	size_t outlen;
+	size_t outcap;
+} mio_s;
+
+int mio_init(mio_s *mio, const char *in, size_t inlen);
+void mio_cleanup(mio_s *mio);
+
+void mio_rewind(mio_s *mio);
+int mio_read(mio_s *mio, void *buf, size_t count);
+int mio_read_line(mio_s *mio, void *buf, size_t count);
+int mio_write(mio_s *mio, const void *buf, size_t count);
+void mio_debug(mio_s *mio, FILE *f);
+void mio_ihex8(mio_s *mio, IHex8 *ih);
+
+#endif	/* mio_h */
@@ -18,8 +18,8 @@
 int nio_init(nio_s *nio)
 {
   nio->fd = 0;
-  nio->info.host = "localhost";
-  nio->info.port = "5331";
+  nio->info.host = NIO_HOST;
+  nio->info.port = NIO_PORT;
   nio->info.timeout = 1;
   return 0;
 }
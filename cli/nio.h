@@ -5,6 +5,9 @@
 
 #define SIO_TTY
 
+#define NIO_HOST "localhost"
+#define NIO_PORT "5331"
+
 typedef struct
 {
         const char *host;
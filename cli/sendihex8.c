@@ -1,27 +1,103 @@
 #include <stdlib.h>
 #include <stdio.h> 
 #include <string.h> 
+#include <getopt.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
 #include "sio.h"
 #include "nio.h"
+#include "fio.h"
+#include "metrics.h"
+#include "jobd.h"
+#include "trace.h"
+#include "session.h"
+#include "cache.h"
+#include "load.h"
 #include "../ihex8.h"
+#include "../device.h"
 
 #define PORT "/dev/cu.usbmodem14101"
-
-
-IHex8Record* load_ihex_data(FILE* fp);
+#define RECORD_SIZE 32
+#define FILL_MAX SESSION_FILL_MAX
+
+typedef struct
+{
+  const char *port;
+  long baud;
+  int resume;
+  const DeviceProfile *device;
+  int metrics;
+  int erase;
+  uint8_t fill[FILL_MAX];
+  int fill_length;
+  const char *daemon;
+  const char *submit;
+  const char *host;
+  int compress;
+  const char *trace;
+  const char *replay;
+  int fast;
+  const char *batch;
+  const char *log;
+  int record_size;
+  int window;
+  const char *chip;
+  const char *read_back;
+  int cache;
+} options_s;
+
+typedef struct
+{
+  const char *slot;
+  const char *path;
+  FILE *out;                    /* where preparing the image reports */
+  FILE *err;
+  char *messages;               /* that report when it was prepared ahead */
+  size_t messages_size;
+  IHex8Image *image;
+  session_payload_s payload;    /* what of the image to send */
+  double parse_time;
+  int rc;
+} burn_s;
+
+
+options_s options = { PORT, 115200, 0, NULL, METRICS_NONE, 0, { 0 }, 0, NULL, NULL, NULL, 0, 
+    NULL, NULL, 0, NULL, NULL, 0, 0, NULL, NULL, 1 };
+session_s session;
+trace_s trace;
+replay_s replay;
+
+int parse_options(const int argc, const char* argv[]);
+void usage(const char* prog);
+int parse_pattern(const char* hex);
+
+int burn(FILE* in);
+int prepare_burn(burn_s* b, FILE* in);
+int program_burn(burn_s* b);
+void free_burn(burn_s* b);
+void burn_config(burn_s* b, session_config_s* config, char* key, size_t size);
+int read_chip(const char* path);
+int run_daemon(void);
+int run_job(job_s* job, const options_s* daemon);
+int job_options(const options_s* daemon);
+int run_batch(void);
+int load_manifest(const char* path, burn_s** burns);
+void* prefetch_burn(void* arg);
+int wait_for_chip(burn_s* b);
+void log_result(FILE* log, burn_s* b, int rc, double seconds);
+
+IHex8Image* load_ihex_data(FILE* fp, FILE* out, FILE* err);
+IHex8Image* parse_ihex_data(FILE* fp, FILE* out, FILE* err);
+uint8_t page_bits(void);
 
 IHex8 *open_controller(const int argc, const char* argv[]);
 IHex8 *open_controller_sio(const char* port, int speed);
 IHex8 *open_controller_nio(const char* host, const char* port);
-
-int await_controller_ready(IHex8* ih);
-int await_controller_done(IHex8* ih);
-int close_controller(IHex8* ih);
-void echo_output(IHex8* ih);
-
-int file_readc(void* fp);
-int file_writec(void* fp, char c);
-int file_writeln(void* fp, const char* s);
+IHex8 *open_controller_replay(const char* path);
+IHex8 *open_trace(IHex8* ih, const char* path);
+int close_trace(int rc);
 
 int sio_writec(void* sio, char c);
 int sio_writeln(void *sio, const char* s);
@@ -32,27 +108,576 @@ int nio_writeln(void *sio, const char* s);
 int nio_readln(void* sio, char* buf, int buflen);
 
 int main(const int argc, const char* argv[]) {
-  int rc = 1;
+  if (parse_options(argc, argv) != 0) return 1;
+  if (options.submit != NULL) {
+    return jobd_submit(options.submit, argc, argv, stdin, stdout);
+  }
+
+  if (options.daemon != NULL) {
+    /* keep the log and each job's status stream flowing line by line */
+    setvbuf(stdout, NULL, _IOLBF, 0);
+  }
+
   IHex8* ctrlr = open_controller(argc, argv);
-  if (ctrlr == NULL) goto error;
+  if (ctrlr == NULL) return 1;
+  session_init(&session, ctrlr, stdout, stderr);
+  if (isatty(fileno(stderr))) session.progress = stderr;
+  if (options.daemon != NULL) return run_daemon();
+  if (options.read_back != NULL) return close_trace(read_chip(options.read_back));
+  if (options.batch != NULL) return close_trace(run_batch());
+  return close_trace(burn(stdin));
+}
 
-  IHex8Record* rex = load_ihex_data(stdin);
- 
-  if (await_controller_ready(ctrlr) != 0) goto error;
-  puts("Sending programming data");
-  if (ihex8Send(rex, ctrlr) != 0) goto error;
-  if (await_controller_done(ctrlr) != 0) goto error;
-  rc = 0;
-  echo_output(ctrlr);
+int burn(FILE* in) {
+  burn_s b;
+  memset(&b, 0, sizeof(b));
+  b.out = stdout;
+  b.err = stderr;
+  prepare_burn(&b, in);
+  int rc = program_burn(&b);
+  free_burn(&b);
+  return rc;
+}
 
-error:
+int prepare_burn(burn_s* b, FILE* in) {
+  /* parses, strips fill and builds the records; only reads options and
+   * touches nothing shared, so that the next image of a batch can be
+   * prepared while the current one burns */
+  double started = metrics_now();
+  b->image = load_ihex_data(in, b->out, b->err);
+  b->rc = b->image != NULL ? 0 : 1;
+  if (b->rc == 0) {
+    session_config_s config;
+    char key[256];
+    burn_config(b, &config, key, sizeof(key));
+    if (session_prepare(&b->payload, b->image, &config, b->out, b->err) != 0) b->rc = 1;
+  }
+  b->parse_time = metrics_now() - started;
+  return b->rc;
+}
+
+int program_burn(burn_s* b) {
+  int rc = 1;
+  if (b->rc == 0) {
+    session_config_s config;
+    char key[256];
+    burn_config(b, &config, key, sizeof(key));
+    /* the probe times the link, so a replay keeps the size it captured */
+    long settled;
+    if (options.replay != NULL && replay_note(&replay, "record-size", &settled) == 0) {
+      config.settle_size = (int) settled;
+    }
+    if (session_submit_prepared(&session, &b->payload, &config) == 0) {
+      rc = session_await(&session, -1, NULL) == SESSION_DONE ? 0 : 1;
+    }
+    if (options.trace != NULL && session.record_size > 0) {
+      trace_note(&trace, "record-size", session.record_size);
+    }
+  }
+  else {
+    metrics_init(&session.metrics);
+  }
+
+  session.metrics.elapsed[PHASE_PARSE] += b->parse_time;
+  if (options.metrics != METRICS_NONE) {
+    metrics_report(&session.metrics, options.metrics, rc == 0, b->err);
+  }
+  return rc;
+}
+
+void free_burn(burn_s* b) {
+  session_payload_free(&b->payload);
+  ihex8ImageFree(b->image);
+  free(b->messages);
+  b->image = NULL;
+  b->messages = NULL;
+}
+
+void burn_config(burn_s* b, session_config_s* config, char* key, size_t size) {
+  session_defaults(config);
+  config->device = options.device;
+  config->resume = options.resume;
+  config->erase = options.erase;
+  memcpy(config->fill, options.fill, sizeof(config->fill));
+  config->fill_length = options.fill_length;
+  config->compress = options.compress;
+  config->record_size = options.record_size;
+  config->window = options.window;
+  if (options.chip == NULL) return;
+
+  /* each slot of a batch holds a chip of its own */
+  if (b->slot != NULL) {
+    snprintf(key, size, "%s.%s", options.chip, b->slot);
+  }
+  else {
+    snprintf(key, size, "%s", options.chip);
+  }
+  config->chip = key;
+}
+
+int read_chip(const char* path) {
+  FILE* fp = fopen(path, "w");
+  if (fp == NULL) {
+    perror(path);
+    return 1;
+  }
+
+  int rc = 1;
+  if (session_read_back(&session, options.device, 0, options.device->capacity) == 0
+      && session_await(&session, -1, NULL) == SESSION_DONE) {
+    IHex8Image* image = session_result(&session);
+    IHex8Record* rex = ihex8ImageRecords(image, RECORD_SIZE);
+    fio_s io = { NULL, fp, stderr };
+    IHex8 ih;
+    fio_ihex8(&io, &ih);
+    ihex8Dump(rex, &ih);
+    ihex8Free(rex);
+    fprintf(stdout, "Read %ld byte(s) into %s\n", session_image_size(image), path);
+    ihex8ImageFree(image);
+    rc = 0;
+  }
+  if (fclose(fp) != 0) {
+    perror(path);
+    rc = 1;
+  }
+  return rc;
+}
+
+int run_daemon(void) {
+  jobd_s jobd;
+  jobd_init(&jobd);
+  jobd.path = options.daemon;
+  if (jobd_open(&jobd) != 0) return 1;
+
+  if (session_sync(&session) != 0) {
+    fputs("warning: controller not ready yet\n", stderr);
+  }
+  fprintf(stdout, "Accepting jobs on %s\n", options.daemon);
+
+  options_s defaults = options;
+  while (1) {
+    job_s* job = jobd_next(&jobd);
+    fprintf(stdout, "Job %d started\n", job->id);
+
+    options = defaults;
+    int rc = run_job(job, &defaults);
+    options = defaults;
+    fprintf(stdout, "Job %d finished with status %d\n", job->id, rc);
+    if (options.trace != NULL) trace_flush(&trace);
+    jobd_finish(&jobd, job, rc);
+  }
+}
+
+int run_job(job_s* job, const options_s* daemon) {
+  FILE* in = fmemopen(job->data, job->size, "r");
+  if (in == NULL) return 1;
+
+  /* the job's own output goes back to its client */
+  fflush(stdout);
+  fflush(stderr);
+  int saved_out = dup(1);
+  int saved_err = dup(2);
+  dup2(job->fd, 1);
+  dup2(job->fd, 2);
+
+  int rc = 1;
+  optind = 0;
+  if (parse_options(job->argc, (const char**) job->argv) == 0 && job_options(daemon) == 0) {
+    rc = burn(in);
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  dup2(saved_out, 1);
+  dup2(saved_err, 2);
+  close(saved_out);
+  close(saved_err);
+  fclose(in);
   return rc;
 }
 
+int job_options(const options_s* daemon) {
+  /* the client's own command line comes along; how to reach the
+   * controller is the daemon's to say, and what it runs is not a job's */
+  options.submit = NULL;
+  options.port = daemon->port;
+  options.baud = daemon->baud;
+  options.host = daemon->host;
+
+  const char* refused = NULL;
+  if (options.daemon != daemon->daemon) refused = "--daemon";
+  else if (options.trace != daemon->trace) refused = "--trace";
+  else if (options.replay != daemon->replay) refused = "--replay";
+  else if (options.fast != daemon->fast) refused = "--fast";
+  else if (options.batch != daemon->batch) refused = "--batch";
+  else if (options.log != daemon->log) refused = "--log";
+  else if (options.read_back != daemon->read_back) refused = "--read";
+  if (refused != NULL) {
+    fprintf(stderr, "error: %s does not apply to a queued job\n", refused);
+    return -1;
+  }
+  return 0;
+}
+
+int run_batch(void) {
+  burn_s* burns;
+  int count = load_manifest(options.batch, &burns);
+  if (count < 0) return 1;
+
+  char path[4096];
+  const char* log_path = options.log;
+  if (log_path == NULL) {
+    snprintf(path, sizeof(path), "%s.log", options.batch);
+    log_path = path;
+  }
+  FILE* log = fopen(log_path, "a");
+  if (log == NULL) {
+    perror(log_path);
+    return 1;
+  }
+  setvbuf(log, NULL, _IOLBF, 0);
+
+  int failed = 0;
+  int done = 0;
+  int i = 0;
+  if (count > 0) prefetch_burn(&burns[0]);
+  for (; i < count; i++) {
+    /* parse the next image while this chip burns */
+    pthread_t prefetcher;
+    int prefetching = 0;
+    if (i + 1 < count) {
+      prefetching = pthread_create(&prefetcher, NULL, prefetch_burn, &burns[i + 1]) == 0;
+      if (!prefetching) prefetch_burn(&burns[i + 1]);
+    }
+
+    int waited = i == 0 ? 0 : wait_for_chip(&burns[i]);
+    if (waited == 0) {
+      fprintf(stdout, "Burning %s into slot %s (%d of %d)\n", 
+          burns[i].path, burns[i].slot, i + 1, count);
+      fwrite(burns[i].messages, 1, burns[i].messages_size, stdout);
+      double started = metrics_now();
+      int rc = program_burn(&burns[i]);
+      log_result(log, &burns[i], rc, metrics_now() - started);
+      done++;
+      if (rc != 0) failed++;
+    }
+
+    if (prefetching) pthread_join(prefetcher, NULL);
+    if (waited != 0) break;
+    free_burn(&burns[i]);
+  }
+  for (int j = 0; j < count; j++) {
+    if (j >= i) free_burn(&burns[j]);
+    free((char*) burns[j].slot);
+    free((char*) burns[j].path);
+  }
+
+  fprintf(stdout, "Batch finished: %d of %d chip(s) burned, %d failed, results in %s\n",
+      done - failed, done, failed, log_path);
+  fclose(log);
+  free(burns);
+  return failed > 0 || done < count;
+}
+
+int load_manifest(const char* path, burn_s** burns) {
+  FILE* fp = fopen(path, "r");
+  if (fp == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  /* one "slot file" pair per line; blank lines and # comments are skipped */
+  char line[1024];
+  int count = 0;
+  int capacity = 0;
+  int lineno = 0;
+  *burns = NULL;
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    lineno++;
+    char* save;
+    char* slot = strtok_r(line, " \t\r\n", &save);
+    if (slot == NULL || slot[0] == '#') continue;
+    char* file = strtok_r(NULL, " \t\r\n", &save);
+    if (file == NULL || strtok_r(NULL, " \t\r\n", &save) != NULL) {
+      fprintf(stderr, "%s:%d: expected a slot and an image file\n", path, lineno);
+      goto error;
+    }
+    if (count == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      burn_s* more = (burn_s*) realloc(*burns, capacity * sizeof(burn_s));
+      if (more == NULL) {
+        fputs("error: out of memory\n", stderr);
+        goto error;
+      }
+      *burns = more;
+    }
+    memset(&(*burns)[count], 0, sizeof(burn_s));
+    (*burns)[count].slot = strdup(slot);
+    (*burns)[count].path = strdup(file);
+    count++;
+  }
+  fclose(fp);
+  return count;
+
+error:
+  for (int i = 0; i < count; i++) {
+    free((char*) (*burns)[i].slot);
+    free((char*) (*burns)[i].path);
+  }
+  free(*burns);
+  fclose(fp);
+  return -1;
+}
+
+void* prefetch_burn(void* arg) {
+  burn_s* b = (burn_s*) arg;
+  b->out = open_memstream(&b->messages, &b->messages_size);
+  if (b->out == NULL) {
+    b->rc = 1;
+    return NULL;
+  }
+  b->err = b->out;
+
+  FILE* in = fopen(b->path, "r");
+  if (in == NULL) {
+    fprintf(b->err, "%s: %s\n", b->path, strerror(errno));
+    b->rc = 1;
+  }
+  else {
+    prepare_burn(b, in);
+    fclose(in);
+  }
+  fclose(b->out);
+  b->out = NULL;
+  b->err = NULL;
+  return NULL;
+}
+
+int wait_for_chip(burn_s* b) {
+  /* a fixture feeding chips automatically does not wait for anyone */
+  if (!isatty(fileno(stdin))) return 0;
+
+  char line[64];
+  fprintf(stdout, "Insert the chip for slot %s and press Enter ", b->slot);
+  fflush(stdout);
+  return fgets(line, sizeof(line), stdin) != NULL ? 0 : -1;
+}
+
+void log_result(FILE* log, burn_s* b, int rc, double seconds) {
+  char stamp[32];
+  time_t now = time(NULL);
+  strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+  fprintf(log, "%s\t%s\t%s\t%s\t%ld\t%.3f\n", stamp, b->slot, b->path,
+      rc == 0 ? "ok" : "failed", b->image != NULL ? session_image_size(b->image) : 0L, seconds);
+}
+
+int parse_options(const int argc, const char* argv[]) {
+  static struct option longopts[] = {
+    { "port", required_argument, NULL, 'p' },
+    { "baud", required_argument, NULL, 'b' },
+    { "resume", no_argument, NULL, 'r' },
+    { "device", required_argument, NULL, 'd' },
+    { "metrics", optional_argument, NULL, 'm' },
+    { "erase", no_argument, NULL, 'e' },
+    { "fill", optional_argument, NULL, 'f' },
+    { "daemon", required_argument, NULL, 'D' },
+    { "submit", required_argument, NULL, 's' },
+    { "host", required_argument, NULL, 'H' },
+    { "compress", no_argument, NULL, 'z' },
+    { "trace", required_argument, NULL, 't' },
+    { "replay", required_argument, NULL, 'R' },
+    { "fast", no_argument, NULL, 'F' },
+    { "batch", required_argument, NULL, 'B' },
+    { "log", required_argument, NULL, 'L' },
+    { "record-size", required_argument, NULL, 'S' },
+    { "window", required_argument, NULL, 'w' },
+    { "chip", required_argument, NULL, 'k' },
+    { "read", required_argument, NULL, 'o' },
+    { "no-cache", no_argument, NULL, 'n' },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  while ((c = getopt_long(argc, (char* const*) argv, "p:b:rd:m::ef::D:s:H:zt:R:FB:L:S:w:k:o:nh", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'p':
+        options.port = optarg;
+        break;
+      case 'b':
+        options.baud = strtol(optarg, NULL, 10);
+        break;
+      case 'r':
+        options.resume = 1;
+        break;
+      case 'd':
+        options.device = deviceFind(optarg);
+        if (options.device == NULL) {
+          fprintf(stderr, "unknown device: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'm':
+        if (optarg == NULL || strcmp(optarg, "text") == 0) {
+          options.metrics = METRICS_TEXT;
+        }
+        else if (strcmp(optarg, "json") == 0) {
+          options.metrics = METRICS_JSON;
+        }
+        else {
+          fprintf(stderr, "unknown metrics format: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'e':
+        options.erase = 1;
+        break;
+      case 'f':
+        if (parse_pattern(optarg != NULL ? optarg : "FF") != 0) {
+          fprintf(stderr, "bad fill pattern: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'D':
+        options.daemon = optarg;
+        break;
+      case 's':
+        options.submit = optarg;
+        break;
+      case 'H':
+        options.host = optarg;
+        break;
+      case 'z':
+        options.compress = 1;
+        break;
+      case 't':
+        options.trace = optarg;
+        break;
+      case 'R':
+        options.replay = optarg;
+        break;
+      case 'F':
+        options.fast = 1;
+        break;
+      case 'B':
+        options.batch = optarg;
+        break;
+      case 'L':
+        options.log = optarg;
+        break;
+      case 'S':
+        options.record_size = atoi(optarg);
+        if (options.record_size < 1 || options.record_size > IHEX8_MAX_LENGTH) {
+          fprintf(stderr, "bad record size: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'w':
+        options.window = atoi(optarg);
+        if (options.window < 1 || options.window > IHEX8_WINDOW_MAX) {
+          fprintf(stderr, "bad window: %s\n", optarg);
+          return -1;
+        }
+        break;
+      case 'k':
+        options.chip = optarg;
+        break;
+      case 'o':
+        options.read_back = optarg;
+        break;
+      case 'n':
+        options.cache = 0;
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+  if (options.device == NULL) {
+    options.device = deviceDefault();
+  }
+  return 0;
+}
+
+void usage(const char* prog) {
+  fprintf(stderr, "usage: %s [-p port | -H host] [-b baud] [-d device] [-r] [-e] [-f[hex]] [-z] [-m[format]] < file.hex\n", prog);
+  fprintf(stderr, "       %s -B manifest [-L log] [options]\n", prog);
+  fprintf(stderr, "       %s -o file.hex [-p port | -H host] [-d device]\n", prog);
+  fprintf(stderr, "       %s -D socket [-p port] [-b baud]\n", prog);
+  fprintf(stderr, "       %s -s socket [options] < file.hex\n", prog);
+  fprintf(stderr, "       %s -R trace [--fast] [options] < file.hex\n", prog);
+  fputs("  -p, --port=PATH   serial port of the controller\n", stderr);
+  fputs("  -b, --baud=N      serial speed (default 115200)\n", stderr);
+  fputs("  -H, --host=H[:P]  reach the controller through a serial bridge instead\n", stderr);
+  fputs("  -d, --device=NAME EEPROM part number; one of", stderr);
+  for (int i = 0; deviceAt(i) != NULL; i++) {
+    fprintf(stderr, " %s", deviceAt(i)->name);
+  }
+  fprintf(stderr, " (default %s)\n", deviceDefault()->name);
+  fputs("  -r, --resume      continue from the controller's last committed address;\n", stderr);
+  fputs("                    the controller keeps it in RAM, so it is lost if the board\n", stderr);
+  fputs("                    loses power or is reset, as the first open after boot does\n", stderr);
+  fputs("  -e, --erase       erase the whole device before programming\n", stderr);
+  fputs("  -f, --fill[=HEX]  fill the whole device with a byte pattern (default FF)\n", stderr);
+  fputs("                    first; data matching the erased or fill pattern is not sent\n", stderr);
+  fputs("  -S, --record-size=N\n", stderr);
+  fputs("                    send N-byte records instead of probing for the best size\n", stderr);
+  fputs("  -w, --window=N    most records sent ahead of their acks (default 8,\n", stderr);
+  fputs("                    1 waits for each ack; errors shrink it as needed,\n", stderr);
+  fputs("                    and no more than the controller's 64-byte buffer holds)\n", stderr);
+  fputs("  -z, --compress    send LZ-compressed records where that is shorter\n", stderr);
+  fputs("  -k, --chip=ID     remember what this chip holds and, while its CRC still\n", stderr);
+  fputs("                    matches, send only bytes that changed (per slot with -B)\n", stderr);
+  fputs("  -n, --no-cache    parse the hex file even if an identical one was parsed\n", stderr);
+  fputs("                    before, and do not keep the result\n", stderr);
+  fputs("  -o, --read=FILE   read the whole chip back into FILE instead of burning\n", stderr);
+  fputs("  -m, --metrics[=F] report phase timings and ack latency as text or json\n", stderr);
+  fputs("                    on stderr, apart from the burn output on stdout\n", stderr);
+  fputs("  -D, --daemon=PATH keep the controller open and run jobs queued on a socket\n", stderr);
+  fputs("  -s, --submit=PATH queue this burn with a daemon and stream its output\n", stderr);
+  fputs("  -B, --batch=FILE  burn each \"slot image.hex\" line of a manifest in turn,\n", stderr);
+  fputs("                    preparing the next image while a chip burns\n", stderr);
+  fputs("  -L, --log=FILE    append per-chip results here (default manifest.log)\n", stderr);
+  fputs("  -t, --trace=FILE  capture all controller traffic with timestamps\n", stderr);
+  fputs("  -R, --replay=FILE answer from a captured trace instead of a controller,\n", stderr);
+  fputs("                    at its original pace unless --fast\n", stderr);
+}
+
+int parse_pattern(const char* hex) {
+  int n = strlen(hex);
+  if (n == 0 || n % 2 != 0 || n > 2 * FILL_MAX) return -1;
+  for (int i = 0; i < n; i += 2) {
+    char byte[3] = { hex[i], hex[i + 1], '\0' };
+    char* end;
+    options.fill[i / 2] = (uint8_t) strtoul(byte, &end, 16);
+    if (*end != '\0') return -1;
+  }
+  options.fill_length = n / 2;
+  return 0;
+}
+
 IHex8* open_controller(const int argc, const char* argv[]) {
-  // TODO use args to set parameters and choose I/O method
-  return open_controller_sio(PORT, 115200);
-//  return open_controller_nio("localhost", "5331");
+  IHex8* ih;
+  if (options.replay != NULL) {
+    ih = open_controller_replay(options.replay);
+  }
+  else if (options.host != NULL) {
+    char* host = strdup(options.host);
+    const char* port = NIO_PORT;
+    char* colon = strrchr(host, ':');
+    if (colon != NULL) {
+      *colon = '\0';
+      port = colon + 1;
+    }
+    ih = open_controller_nio(host, port);
+  }
+  else {
+    ih = open_controller_sio(options.port, options.baud);
+  }
+  if (ih != NULL && options.trace != NULL) {
+    ih = open_trace(ih, options.trace);
+  }
+  return ih;
 }
 
 IHex8* open_controller_sio(const char* port, int speed) {
@@ -68,10 +693,12 @@ IHex8* open_controller_sio(const char* port, int speed) {
   }
 
   IHex8* ih = (IHex8*) malloc(sizeof(IHex8));
+  ih->readc = NULL;
   ih->writec = sio_writec;
   ih->writeln = sio_writeln;
   ih->readln = sio_readln;
   ih->ctx = sio;
+  ih->report = NULL;
 
   return ih;
 }
@@ -88,111 +715,77 @@ IHex8* open_controller_nio(const char* host, const char* port) {
   }
 
   IHex8* ih = (IHex8*) malloc(sizeof(IHex8));
+  ih->readc = NULL;
   ih->writec = nio_writec;
   ih->writeln = nio_writeln;
   ih->readln = nio_readln;
   ih->ctx = nio;
+  ih->report = NULL;
 
   return ih;
 }
 
-int await_controller_ready(IHex8* ih) {
-  char buf[256];
-  fputs("Syncing controller\n", stdout);
-  int max_tries = 30;
-  int ok = 5;
-  while (max_tries > 0) { 
-    ih->writec(ih->ctx, '\n');
-    if (ih->readln(ih->ctx, buf, sizeof(buf)) == -1) {
-      fputs("error in await_controller_ready\n", stderr);
-      return -1;
-    }
-    if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
-      fprintf(stdout, "%s\n", buf+strlen(MSG_INFO) + 1);
-      continue;
-    }
-    if (strncmp(buf, MSG_OK, strlen(buf)) == 0) {
-      ok--;
-      if (ok == 0) {
-        fputs("Controller ready\n", stdout);
-        return 0;
-      }
-    }
-    max_tries--;
+IHex8* open_controller_replay(const char* path) {
+  FILE* fp = fopen(path, "rb");
+  if (fp == NULL) {
+    perror(path);
+    return NULL;
   }
-
-  fputs("timeout in await_controller_ready\n", stderr);
-  return -1;
+  IHex8* ih = replay_open(&replay, fp, !options.fast);
+  fclose(fp);
+  return ih;
 }
 
-int await_controller_done(IHex8* ih) {
-  char buf[256];
-  int max_tries = 60;
-  while (max_tries) {
-    int n = ih->readln(ih->ctx, buf, sizeof(buf));
-    if (n == -1) {
-      fputs("error in await_controller_done\n", stderr);
-      return -1;
-    }
-    if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
-      fprintf(stdout, "%s\n", buf+strlen(MSG_INFO) + 1);
-      continue;
-    }
-    if (strncmp(buf, MSG_OK, strlen(buf)) == 0) {
-      return 0;
-    }
-    if (strncmp(buf, MSG_ERROR, strlen(MSG_ERROR)) == 0) {
-      return -1;
-    }
-    if (n > 0) {
-      fputs(buf, stdout);
-      fputc('\n', stdout);
-    }
-    max_tries--;
+IHex8* open_trace(IHex8* ih, const char* path) {
+  FILE* fp = fopen(path, "wb");
+  if (fp == NULL) {
+    perror(path);
+    return NULL;
   }
-  fputs("timeout in await_controller_done\n", stderr);
-  return -1;
+  return trace_wrap(&trace, ih, fp);
 }
 
-void echo_output(IHex8* ih) {
-  char buf[256];
-  while (1) {
-    int len = ih->readln(ih->ctx, buf, sizeof(buf));
-    if (len < 0) {
-      fputs("error reading output\n", stderr);
-      break;
-    }
-    if (len == 0) continue;
-    if (strncmp(buf, MSG_OK, strlen(buf)) == 0) {
-      break;
-    }
-    fputs(buf, stdout);
-    fputc('\n', stdout); 
+int close_trace(int rc) {
+  if (options.trace != NULL) trace_close(&trace);
+  if (options.replay != NULL) {
+    if (replay_report(&replay, stderr) != 0 && rc == 0) rc = 1;
+    replay_close(&replay);
   }
+  return rc;
 }
 
-IHex8Record* load_ihex_data(FILE* fp) {
-  IHex8 ih;
-  ih.readc = file_readc;
-  ih.writec = file_writec;
-  ih.writeln = file_writeln;
-  ih.ctx = fp;
-  IHex8Record* rex = ihex8Load(&ih);
-  ih.ctx = stdout;
-  return rex;
-}
+IHex8Image* load_ihex_data(FILE* fp, FILE* out, FILE* err) {
+  /* a file parsed before comes back from the cache, keyed by its contents */
+  char key[LOAD_KEY_SIZE];
+  IHex8Image* image;
+  int keyed = options.cache && load_key(fp, page_bits(), key, sizeof(key)) == 0;
+  if (keyed && cache_load_image(key, page_bits(), &image) == 0) {
+    fseek(fp, 0, SEEK_END);
+    return image;
+  }
 
-int file_readc(void* fp) {
-  return fgetc((FILE*) fp);
+  image = parse_ihex_data(fp, out, err);
+  if (image != NULL && keyed && cache_save_image(key, image, err) != 0) {
+    fputs("warning: parsed image not cached\n", err);
+  }
+  return image;
 }
 
-int file_writec(void* fp, char c) {
-  return fputc(c, stdout);
+IHex8Image* parse_ihex_data(FILE* fp, FILE* out, FILE* err) {
+  /* a big file on disk is split across cores; anything else, or a file
+   * using record types only ihex8.c decodes, is read as a stream */
+  IHex8Image* image;
+  int rc = load_mapped(fp, page_bits(), err, &image);
+  if (rc != LOAD_UNSUITABLE) return rc == LOAD_OK ? image : NULL;
+
+  fio_s io = { fp, out, err };
+  IHex8 ih;
+  fio_ihex8(&io, &ih);
+  return ihex8LoadImage(&ih, page_bits());
 }
 
-int file_writeln(void* fp, const char* s) {
-  fputs(s, stdout);
-  return fputc('\n', stdout);
+uint8_t page_bits(void) {
+  return session_page_bits(options.device);
 }
 
 int sio_writec(void* ctx, char c) {
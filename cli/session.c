@@ -0,0 +1,805 @@
+/*
+ * session.c *
+ * drive one controller from a thread of its own
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+
+#include "session.h"
+#include "tune.h"
+#include "cache.h"
+
+#define PAGE_BITS 6
+#define RECORD_SIZE 32
+#define RESUME_TRIES 3
+#define FILL_MIN_RUN 8
+
+static int claim(session_s *s);
+static int start_job(session_s *s);
+static void reap(session_s *s);
+static void *run_job(void *arg);
+static int run_burn(session_s *s);
+static int run_read(session_s *s);
+static void begin(session_s *s, phase_e phase);
+static void set_bytes(session_s *s, long bytes, long total);
+
+static int link_readln(void *ctx, char *buf, int buflen);
+static int link_writec(void *ctx, char c);
+static int link_writeln(void *ctx, const char *line);
+static void link_report(void *ctx, int kind, const char *line);
+static void on_sent(IHex8Record *rec, void *ctx);
+static void on_acked(IHex8Record *rec, void *ctx);
+static void on_nacked(IHex8Record *rec, void *ctx);
+
+static int prepare_payload(session_s *s);
+static int check_capacity(IHex8Image *image, const session_config_s *c, FILE *err);
+static IHex8Image *strip_fill(IHex8Image *image, const session_config_s *c, FILE *out, FILE *err);
+static int compress_records(IHex8Record *rex, FILE *out, FILE *err);
+static int await_ready(session_s *s);
+static int select_device(session_s *s);
+static int prepare_device(session_s *s);
+static int check_chip(session_s *s, chip_state_s *chip);
+static void save_chip(session_s *s, chip_state_s *chip);
+static long query_crc(session_s *s);
+static int send_image(session_s *s);
+static long query_resume(session_s *s);
+static int await_done(session_s *s);
+static void show_info(session_s *s, const char *buf);
+static int verify_output(session_s *s);
+static uint8_t record_size(const session_config_s *c);
+
+int session_init(session_s *s, IHex8 *ih, FILE *out, FILE *err)
+{
+  memset(s, 0, sizeof(session_s));
+  s->ih = ih;
+  s->link.readc = NULL;
+  s->link.readln = link_readln;
+  s->link.writec = link_writec;
+  s->link.writeln = link_writeln;
+  s->link.ctx = s;
+  s->link.report = link_report;
+  s->out = out;
+  s->err = err;
+  s->state.state = SESSION_IDLE;
+  session_defaults(&s->config);
+  metrics_init(&s->metrics);
+  pthread_mutex_init(&s->lock, NULL);
+  pthread_cond_init(&s->changed, NULL);
+  return 0;
+}
+
+void session_cleanup(session_s *s)
+{
+  session_cancel(s);
+  reap(s);
+  if (s->reading) ihex8ImageFree(s->image);
+  s->image = NULL;
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->changed);
+}
+
+void session_defaults(session_config_s *c)
+{
+  memset(c, 0, sizeof(session_config_s));
+  c->device = deviceDefault();
+}
+
+int session_submit(session_s *s, IHex8Image *image, const session_config_s *c)
+{
+  /* the image is the caller's and must outlive the job */
+  if (claim(s) != 0) return -1;
+  s->config = *c;
+  s->image = image;
+  s->reading = 0;
+  return start_job(s);
+}
+
+int session_submit_prepared(session_s *s, session_payload_s *p, const session_config_s *c)
+{
+  /* the job takes the payload over; the image stays the caller's */
+  if (claim(s) != 0) return -1;
+  s->config = *c;
+  s->image = p->image;
+  s->payload = p->payload;
+  s->rex = p->rex;
+  s->reading = 0;
+  memset(p, 0, sizeof(session_payload_s));
+  return start_job(s);
+}
+
+int session_prepare(session_payload_s *p, IHex8Image *image, const session_config_s *c,
+    FILE *out, FILE *err)
+{
+  /* touches nothing but its arguments, so it may run ahead on another thread */
+  memset(p, 0, sizeof(session_payload_s));
+  p->image = image;
+  if (image->pageBits != session_page_bits(c->device)) {
+    fprintf(err, "error: image is not paged for %s\n", c->device->name);
+    return -1;
+  }
+  if (check_capacity(image, c, err) != 0) return -1;
+
+  p->payload = strip_fill(image, c, out, err);
+  if (p->payload == NULL) return -1;
+
+  p->rex = ihex8ImageRecords(p->payload, record_size(c));
+  if (c->compress && compress_records(p->rex, out, err) != 0) {
+    session_payload_free(p);
+    return -1;
+  }
+  return 0;
+}
+
+void session_payload_free(session_payload_s *p)
+{
+  ihex8Free(p->rex);
+  if (p->payload != p->image) ihex8ImageFree(p->payload);
+  p->rex = NULL;
+  p->payload = NULL;
+}
+
+int session_read_back(session_s *s, const DeviceProfile *device, long start, long end)
+{
+  if (start < 0 || start >= end || end > (long) device->capacity) {
+    fprintf(s->err, "error: cannot read %04lX-%04lX of %s\n", start, end, device->name);
+    return -1;
+  }
+  if (claim(s) != 0) return -1;
+  session_defaults(&s->config);
+  s->config.device = device;
+  s->image = NULL;
+  s->reading = 1;
+  s->start = start;
+  s->end = end;
+  return start_job(s);
+}
+
+int session_poll(session_s *s, session_progress_s *p)
+{
+  pthread_mutex_lock(&s->lock);
+  session_progress_s now = s->state;
+  pthread_mutex_unlock(&s->lock);
+  if (now.state != SESSION_RUNNING) reap(s);
+  if (p != NULL) *p = now;
+  return now.state;
+}
+
+int session_await(session_s *s, double timeout, session_progress_s *p)
+{
+  /* a negative timeout waits for as long as the job takes */
+  struct timespec until;
+  clock_gettime(CLOCK_REALTIME, &until);
+  if (timeout > 0) {
+    long ns = until.tv_nsec + (long) ((timeout - (long) timeout) * 1e9);
+    until.tv_sec += (time_t) timeout + ns / 1000000000L;
+    until.tv_nsec = ns % 1000000000L;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  int rc = 0;
+  while (s->state.state == SESSION_RUNNING && rc != ETIMEDOUT) {
+    if (timeout < 0) {
+      pthread_cond_wait(&s->changed, &s->lock);
+    }
+    else {
+      rc = pthread_cond_timedwait(&s->changed, &s->lock, &until);
+    }
+  }
+  session_progress_s now = s->state;
+  pthread_mutex_unlock(&s->lock);
+  if (now.state != SESSION_RUNNING) reap(s);
+  if (p != NULL) *p = now;
+  return now.state;
+}
+
+void session_cancel(session_s *s)
+{
+  /* the job fails at its next read from the controller, which the
+   * transports bound by their own timeout */
+  pthread_mutex_lock(&s->lock);
+  if (s->state.state == SESSION_RUNNING) s->cancelled = 1;
+  pthread_mutex_unlock(&s->lock);
+}
+
+IHex8Image *session_result(session_s *s)
+{
+  /* what a finished read back found; the caller frees it */
+  if (session_poll(s, NULL) != SESSION_DONE || !s->reading) return NULL;
+  IHex8Image *image = s->image;
+  s->image = NULL;
+  return image;
+}
+
+int session_sync(session_s *s)
+{
+  if (claim(s) != 0) return -1;
+  s->cancelled = 0;
+  return await_ready(s);
+}
+
+uint8_t session_page_bits(const DeviceProfile *device)
+{
+  return device->pageBits > 0 ? device->pageBits : PAGE_BITS;
+}
+
+long session_image_size(IHex8Image *image)
+{
+  long size = 0;
+  IHex8Page *page = NULL;
+  while ((page = ihex8ImageNext(image, page)) != NULL) {
+    size += page->count;
+  }
+  return size;
+}
+
+static int claim(session_s *s)
+{
+  if (session_poll(s, NULL) == SESSION_RUNNING) {
+    fputs("error: session is busy\n", s->err);
+    return -1;
+  }
+  if (s->reading) ihex8ImageFree(s->image);
+  s->image = NULL;
+  s->reading = 0;
+  return 0;
+}
+
+static int start_job(session_s *s)
+{
+  pthread_mutex_lock(&s->lock);
+  memset(&s->state, 0, sizeof(session_progress_s));
+  s->state.state = SESSION_RUNNING;
+  s->state.phase = PHASE_PARSE;
+  s->cancelled = 0;
+  pthread_mutex_unlock(&s->lock);
+
+  if (pthread_create(&s->worker, NULL, run_job, s) != 0) {
+    fputs("error: cannot start a session thread\n", s->err);
+    pthread_mutex_lock(&s->lock);
+    s->state.state = SESSION_FAILED;
+    pthread_mutex_unlock(&s->lock);
+    return -1;
+  }
+  s->joinable = 1;
+  return 0;
+}
+
+static void reap(session_s *s)
+{
+  pthread_mutex_lock(&s->lock);
+  int joinable = s->joinable;
+  s->joinable = 0;
+  pthread_mutex_unlock(&s->lock);
+  if (joinable) pthread_join(s->worker, NULL);
+}
+
+static void *run_job(void *arg)
+{
+  session_s *s = (session_s *) arg;
+  metrics_init(&s->metrics);
+  s->metrics.progress = s->progress;
+  s->record_size = 0;
+  s->resumed = 0;
+  int rc = s->reading ? run_read(s) : run_burn(s);
+  for (int i = 0; i < PHASE_COUNT; i++) {
+    metrics_end(&s->metrics, i);
+  }
+
+  ihex8Free(s->rex);
+  if (s->payload != s->image) ihex8ImageFree(s->payload);
+  s->rex = NULL;
+  s->payload = NULL;
+  if (rc != 0 && s->reading) {
+    ihex8ImageFree(s->image);
+    s->image = NULL;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  if (rc == 0) {
+    s->state.state = SESSION_DONE;
+  }
+  else if (s->cancelled) {
+    fputs("cancelled\n", s->err);
+    s->state.state = SESSION_CANCELLED;
+  }
+  else {
+    s->state.state = SESSION_FAILED;
+  }
+  pthread_cond_broadcast(&s->changed);
+  pthread_mutex_unlock(&s->lock);
+  return NULL;
+}
+
+static int run_burn(session_s *s)
+{
+  int rc = -1;
+  chip_state_s chip = { { 0 }, 0, NULL };
+
+  begin(s, PHASE_PARSE);
+  if (prepare_payload(s) != 0) goto error;
+  metrics_end(&s->metrics, PHASE_PARSE);
+
+  begin(s, PHASE_SYNC);
+  if (await_ready(s) != 0) goto error;
+  if (select_device(s) != 0) goto error;
+  metrics_end(&s->metrics, PHASE_SYNC);
+
+  begin(s, PHASE_ERASE);
+  int incremental = s->config.chip != NULL ? check_chip(s, &chip) : 0;
+  if (incremental < 0) goto error;
+  if (!incremental && prepare_device(s) != 0) goto error;
+  metrics_end(&s->metrics, PHASE_ERASE);
+
+  begin(s, PHASE_SEND);
+  if (send_image(s) != 0) goto error;
+  metrics_end(&s->metrics, PHASE_SEND);
+
+  begin(s, PHASE_WRITE);
+  if (await_done(s) != 0) goto error;
+  metrics_end(&s->metrics, PHASE_WRITE);
+
+  begin(s, PHASE_VERIFY);
+  if (verify_output(s) != 0) goto error;
+  if (s->config.chip != NULL) save_chip(s, &chip);
+  metrics_end(&s->metrics, PHASE_VERIFY);
+  rc = 0;
+
+error:
+  cache_free_chip(&chip);
+  return rc;
+}
+
+static int run_read(session_s *s)
+{
+  begin(s, PHASE_SYNC);
+  if (await_ready(s) != 0) return -1;
+  if (select_device(s) != 0) return -1;
+  metrics_end(&s->metrics, PHASE_SYNC);
+
+  begin(s, PHASE_VERIFY);
+  s->image = ihex8ImageCreate(session_page_bits(s->config.device));
+  if (s->image == NULL) {
+    fputs("error: out of memory\n", s->err);
+    return -1;
+  }
+  fprintf(s->out, "Reading %04lX-%04lX\n", s->start, s->end - 1);
+
+  /* each reply echoes its address, so a late answer to a retried
+   * command is not taken for the next one */
+  long address = s->start;
+  while (address < s->end) {
+    char cmd[32];
+    char reply[64];
+    snprintf(cmd, sizeof(cmd), "%s %04lX", CMD_READ, address);
+    if (ihex8Command(&s->link, cmd, reply, sizeof(reply)) != 0) return -1;
+
+    char *p;
+    if (strtol(reply, &p, 16) != address || *p != ' ') {
+      fprintf(s->err, "error: unexpected reply to %s: %s\n", cmd, reply);
+      return -1;
+    }
+    p++;
+    long n = 0;
+    for (; address + n < s->end && isxdigit((unsigned char) p[0])
+        && isxdigit((unsigned char) p[1]); n++, p += 2) {
+      char byte[3] = { p[0], p[1], '\0' };
+      if (ihex8ImagePut(s->image, address + n, (uint8_t) strtoul(byte, NULL, 16)) < 0) {
+        fputs("error: out of memory\n", s->err);
+        return -1;
+      }
+    }
+    if (n == 0) {
+      fprintf(s->err, "error: no data at %04lX\n", address);
+      return -1;
+    }
+    address += n;
+    set_bytes(s, address - s->start, s->end - s->start);
+  }
+  metrics_end(&s->metrics, PHASE_VERIFY);
+  return 0;
+}
+
+static void begin(session_s *s, phase_e phase)
+{
+  metrics_begin(&s->metrics, phase);
+  pthread_mutex_lock(&s->lock);
+  s->state.phase = phase;
+  pthread_mutex_unlock(&s->lock);
+}
+
+static void set_bytes(session_s *s, long bytes, long total)
+{
+  pthread_mutex_lock(&s->lock);
+  s->state.bytes = bytes;
+  s->state.total = total;
+  pthread_mutex_unlock(&s->lock);
+}
+
+static int link_readln(void *ctx, char *buf, int buflen)
+{
+  session_s *s = (session_s *) ctx;
+  pthread_mutex_lock(&s->lock);
+  int cancelled = s->cancelled;
+  pthread_mutex_unlock(&s->lock);
+  if (cancelled) return -1;
+  return s->ih->readln(s->ih->ctx, buf, buflen);
+}
+
+static int link_writec(void *ctx, char c)
+{
+  session_s *s = (session_s *) ctx;
+  return s->ih->writec(s->ih->ctx, c);
+}
+
+static int link_writeln(void *ctx, const char *line)
+{
+  session_s *s = (session_s *) ctx;
+  return s->ih->writeln(s->ih->ctx, line);
+}
+
+static void link_report(void *ctx, int kind, const char *line)
+{
+  /* the library's diagnostics go where the job reports */
+  session_s *s = (session_s *) ctx;
+  fprintf(kind == IHEX8_REPORT_INFO ? s->out : s->err, "%s\n", line);
+}
+
+static void on_sent(IHex8Record *rec, void *ctx)
+{
+  session_s *s = (session_s *) ctx;
+  s->monitor.sent(rec, s->monitor.ctx);
+}
+
+static void on_acked(IHex8Record *rec, void *ctx)
+{
+  session_s *s = (session_s *) ctx;
+  s->monitor.acked(rec, s->monitor.ctx);
+  set_bytes(s, s->metrics.bytes, s->metrics.total_bytes);
+}
+
+static void on_nacked(IHex8Record *rec, void *ctx)
+{
+  session_s *s = (session_s *) ctx;
+  s->monitor.nacked(rec, s->monitor.ctx);
+}
+
+static int prepare_payload(session_s *s)
+{
+  if (s->payload != NULL) return 0;	/* the caller prepared it ahead */
+  session_payload_s p;
+  int rc = session_prepare(&p, s->image, &s->config, s->out, s->err);
+  s->payload = p.payload;
+  s->rex = p.rex;
+  return rc;
+}
+
+static int check_capacity(IHex8Image *image, const session_config_s *c, FILE *err)
+{
+  long capacity = c->device->capacity;
+  long size = 1L << image->pageBits;
+  IHex8Page *page = NULL;
+  while ((page = ihex8ImageNext(image, page)) != NULL) {
+    long base = (long) page->address << image->pageBits;
+    if (base + size <= capacity) continue;
+    for (long i = 0; i < size; i++) {
+      if (ihex8PageHas(page, i) && base + i >= capacity) {
+        fprintf(err, "error: data at %04lX exceeds %s capacity\n",
+            base + i, c->device->name);
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+static IHex8Image *strip_fill(IHex8Image *image, const session_config_s *c, FILE *out, FILE *err)
+{
+  static const uint8_t erased = 0xFF;
+  IHex8Image *stripped;
+  if (c->fill_length > 0) {
+    stripped = ihex8ImageStrip(image, c->fill, c->fill_length, FILL_MIN_RUN);
+  }
+  else if (c->erase) {
+    stripped = ihex8ImageStrip(image, &erased, 1, FILL_MIN_RUN);
+  }
+  else {
+    return image;
+  }
+
+  if (stripped == NULL) {
+    fputs("error: out of memory\n", err);
+    return NULL;
+  }
+  long size = session_image_size(image);
+  fprintf(out, "Skipping %ld of %ld byte(s) already set by %s\n",
+      size - session_image_size(stripped), size, c->fill_length > 0 ? "fill" : "erase");
+  return stripped;
+}
+
+static int compress_records(IHex8Record *rex, FILE *out, FILE *err)
+{
+  long before = 0;
+  for (IHex8Record *rec = rex; rec != NULL; rec = rec->next) {
+    before += rec->length;
+  }
+  long saved = ihex8Compress(rex);
+  if (saved < 0) {
+    fputs("error: out of memory\n", err);
+    return -1;
+  }
+  fprintf(out, "Compressed %ld byte(s) to %ld\n", before, before - saved);
+  return 0;
+}
+
+static int await_ready(session_s *s)
+{
+  char buf[256];
+  fputs("Syncing controller\n", s->out);
+  int max_tries = 30;
+  int ok = 5;
+  while (max_tries > 0) {
+    s->link.writec(s->link.ctx, '\n');
+    int n = s->link.readln(s->link.ctx, buf, sizeof(buf));
+    if (n == -1) {
+      fputs("error in await_controller_ready\n", s->err);
+      return -1;
+    }
+    if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
+      show_info(s, buf);
+      continue;
+    }
+    /* a timeout reads as an empty line, which is not an answer */
+    if (n > 0 && strcmp(buf, MSG_OK) == 0) {
+      ok--;
+      if (ok == 0) {
+        fputs("Controller ready\n", s->out);
+        return 0;
+      }
+    }
+    max_tries--;
+  }
+
+  fputs("timeout in await_controller_ready\n", s->err);
+  return -1;
+}
+
+static int select_device(session_s *s)
+{
+  char cmd[32];
+  snprintf(cmd, sizeof(cmd), "%s %s", CMD_DEVICE, s->config.device->name);
+  return ihex8Command(&s->link, cmd, NULL, 0);
+}
+
+static int prepare_device(session_s *s)
+{
+  session_config_s *c = &s->config;
+  char cmd[40];
+  if (!c->erase && c->fill_length == 0) return 0;
+  if (c->resume) {
+    /* the interrupted run already prepared the device */
+    return 0;
+  }
+
+  if (c->erase) {
+    fputs("Erasing device\n", s->out);
+    if (ihex8Command(&s->link, CMD_ERASE, NULL, 0) != 0) return -1;
+  }
+  if (c->fill_length > 0) {
+    int n = snprintf(cmd, sizeof(cmd), "%s 0000 %04lX ", CMD_FILL,
+        (unsigned long) c->device->capacity);
+    for (int i = 0; i < c->fill_length; i++) {
+      n += snprintf(cmd + n, sizeof(cmd) - n, "%02X", c->fill[i]);
+    }
+    fputs("Filling device\n", s->out);
+    if (ihex8Command(&s->link, cmd, NULL, 0) != 0) return -1;
+  }
+  return 0;
+}
+
+static int check_chip(session_s *s, chip_state_s *chip)
+{
+  /* the cached copy describes the chip only if nothing wrote to it since;
+   * erasing or filling rewrites it anyway */
+  session_config_s *c = &s->config;
+  if (c->erase || c->fill_length > 0) return 0;
+  if (cache_load_chip(chip, c->chip, session_page_bits(c->device), s->err) != 0) return 0;
+
+  long crc = query_crc(s);
+  if (crc != chip->crc || strcmp(chip->device, c->device->name) != 0) {
+    fprintf(s->out, "Chip %s changed since it was cached, sending everything\n", c->chip);
+    cache_free_chip(chip);
+    return 0;
+  }
+
+  IHex8Image *diff = ihex8ImageDiff(chip->image, s->image);
+  if (diff == NULL) {
+    fputs("error: out of memory\n", s->err);
+    return -1;
+  }
+  fprintf(s->out, "Chip %s matches its cached copy, %ld of %ld byte(s) changed\n",
+      c->chip, session_image_size(diff), session_image_size(s->image));
+  if (s->payload != s->image) ihex8ImageFree(s->payload);
+  s->payload = diff;
+  ihex8Free(s->rex);
+  s->rex = ihex8ImageRecords(diff, record_size(c));
+  if (c->compress && compress_records(s->rex, s->out, s->err) != 0) return -1;
+  return 1;
+}
+
+static void save_chip(session_s *s, chip_state_s *chip)
+{
+  /* what was there before and still is, plus what was just verified */
+  session_config_s *c = &s->config;
+  long crc = query_crc(s);
+  if (crc < 0) {
+    fprintf(s->err, "warning: controller gave no CRC, chip %s not cached\n", c->chip);
+    return;
+  }
+  if (chip->image == NULL) chip->image = ihex8ImageCreate(session_page_bits(c->device));
+  if (chip->image == NULL || ihex8ImageMerge(chip->image, s->image) < 0) {
+    fputs("error: out of memory\n", s->err);
+    return;
+  }
+  snprintf(chip->device, sizeof(chip->device), "%s", c->device->name);
+  chip->crc = (uint16_t) crc;
+  if (cache_save_chip(chip, c->chip, s->err) != 0) {
+    fprintf(s->err, "warning: chip %s not cached\n", c->chip);
+  }
+}
+
+static long query_crc(session_s *s)
+{
+  char reply[32];
+  if (ihex8Command(&s->link, CMD_CRC, reply, sizeof(reply)) != 0) return -1;
+  return strtol(reply, NULL, 16);
+}
+
+static int send_image(session_s *s)
+{
+  /* the record size is probed on the link unless fixed by the user or
+   * by compression, whose blocks are built ahead */
+  session_config_s *c = &s->config;
+  tune_s tune;
+  int fixed = c->record_size > 0 || c->compress;
+  tune_init(&tune, 1 << session_page_bits(c->device), fixed ? record_size(c) : 0, c->window);
+  tune.settle = c->settle_size;
+
+  long start = 0;
+  if (c->resume) {
+    start = query_resume(s);
+    if (start < 0) return -1;
+  }
+  else if (ihex8Command(&s->link, CMD_RESUME " 0", NULL, 0) != 0) {
+    return -1;
+  }
+
+  for (int tries = 0; tries < RESUME_TRIES; tries++) {
+    if (start > 0) {
+      s->resumed = 1;
+      start = start > tune_slack(&tune) ? start - tune_slack(&tune) : 0;
+      fprintf(s->out, "Resuming at %04lX\n", start);
+    }
+    IHex8Record *top = s->rex;
+    while (top != NULL && top->address + top->length <= start) {
+      top = top->next;
+    }
+
+    fputs("Sending programming data\n", s->out);
+    IHex8Monitor monitor = { on_sent, on_acked, on_nacked, s };
+    metrics_monitor(&s->metrics, &s->monitor);
+    metrics_expect(&s->metrics, top);
+    set_bytes(s, s->metrics.bytes, s->metrics.total_bytes);
+    int sent = tune_send(&tune, &s->link, s->payload, fixed ? s->rex : NULL, start, &monitor);
+    s->record_size = tune.size;
+    if (sent == 0) {
+      metrics_end(&s->metrics, PHASE_SEND);
+      tune_report(&tune, s->out);
+      return 0;
+    }
+
+    if (await_ready(s) != 0) return -1;
+    start = query_resume(s);
+    if (start < 0) return -1;
+  }
+
+  fputs("giving up after repeated failures\n", s->err);
+  return -1;
+}
+
+static long query_resume(session_s *s)
+{
+  char reply[32];
+  if (ihex8Command(&s->link, CMD_RESUME, reply, sizeof(reply)) != 0) return -1;
+  return strtol(reply, NULL, 16);
+}
+
+static int await_done(session_s *s)
+{
+  char buf[256];
+  int max_tries = 60;
+  while (max_tries) {
+    int n = s->link.readln(s->link.ctx, buf, sizeof(buf));
+    if (n == -1) {
+      fputs("error in await_controller_done\n", s->err);
+      return -1;
+    }
+    if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
+      show_info(s, buf);
+      continue;
+    }
+    if (n > 0 && strcmp(buf, MSG_OK) == 0) {
+      return 0;
+    }
+    if (strncmp(buf, MSG_ERROR, strlen(MSG_ERROR)) == 0) {
+      return -1;
+    }
+    if (n > 0) {
+      fputs(buf, s->out);
+      fputc('\n', s->out);
+    }
+    max_tries--;
+  }
+  fputs("timeout in await_controller_done\n", s->err);
+  return -1;
+}
+
+static void show_info(session_s *s, const char *buf)
+{
+  /* a bare INFO is only a keepalive */
+  if (buf[strlen(MSG_INFO)] != '\0') {
+    fprintf(s->out, "%s\n", buf + strlen(MSG_INFO) + 1);
+  }
+}
+
+static int verify_output(session_s *s)
+{
+  char buf[256];
+  long verified = -1;
+
+  while (1) {
+    int len = s->link.readln(s->link.ctx, buf, sizeof(buf));
+    if (len < 0) {
+      fputs("error reading output\n", s->err);
+      return -1;
+    }
+    if (len == 0) continue;
+    if (strncmp(buf, MSG_OK, strlen(buf)) == 0) {
+      break;
+    }
+    if (strncmp(buf, MSG_VERIFIED " ", strlen(MSG_VERIFIED) + 1) == 0) {
+      /* the controller read each page back as it wrote it */
+      verified = strtol(buf + strlen(MSG_VERIFIED) + 1, NULL, 10);
+      continue;
+    }
+    fputs(buf, s->out);
+    fputc('\n', s->out);
+  }
+
+  if (verified == -1) {
+    fputs("controller did not report what it verified\n", s->err);
+    return -1;
+  }
+  /* the controller counts what it wrote since the burn last (re)started,
+   * and a resent duplicate counts again, so only a shortfall of a whole
+   * burn means records went missing */
+  long sent = session_image_size(s->payload);
+  if (!s->resumed && verified < sent) {
+    fprintf(s->err, "verify failed: controller wrote %ld of %ld byte(s)\n",
+        verified, sent);
+    return -1;
+  }
+  fprintf(s->out, "Verified %ld byte(s) on the controller\n", verified);
+  return 0;
+}
+
+static uint8_t record_size(const session_config_s *c)
+{
+  if (c->compress) return IHEX8_LZ_BLOCK;
+  if (c->record_size > 0) return c->record_size;
+  return c->device->pageBits > 0 ? 1 << c->device->pageBits : RECORD_SIZE;
+}
@@ -0,0 +1,93 @@
+#ifndef session_h
+#define session_h
+
+#include <stdio.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "../ihex8.h"
+#include "../device.h"
+
+#define SESSION_FILL_MAX 8
+
+#define SESSION_IDLE 0
+#define SESSION_RUNNING 1
+#define SESSION_DONE 2
+#define SESSION_FAILED 3
+#define SESSION_CANCELLED 4
+
+typedef struct
+{
+	const DeviceProfile *device;
+	int resume;		/* continue from the controller's last address */
+	int erase;
+	uint8_t fill[SESSION_FILL_MAX];
+	int fill_length;
+	int compress;
+	int record_size;	/* 0 probes the link for the best size */
+	int settle_size;	/* probe, but keep this size, as a trace did */
+	int window;		/* 0 for the default */
+	const char *chip;	/* cache key of the chip, or NULL; not copied,
+				 * so it must stay valid until the job ends */
+} session_config_s;
+
+typedef struct
+{
+	int state;
+	phase_e phase;		/* of the job, while it runs */
+	long bytes;		/* sent or read back so far */
+	long total;
+} session_progress_s;
+
+typedef struct
+{
+	IHex8Image *image;	/* the caller's */
+	IHex8Image *payload;	/* the part of it to send */
+	IHex8Record *rex;	/* the payload as records, compressed if asked */
+} session_payload_s;
+
+typedef struct
+{
+	IHex8 *ih;		/* the controller */
+	IHex8 link;		/* what a job talks to; a cancel cuts it */
+	FILE *out;		/* where jobs report, as sendihex8 does */
+	FILE *err;
+	FILE *progress;		/* live send progress, or NULL */
+	metrics_s metrics;	/* of the last job, once it finished */
+	session_config_s config;
+	IHex8Image *image;	/* to burn, or read back */
+	IHex8Image *payload;	/* the part of it to send */
+	IHex8Record *rex;
+	int record_size;	/* the last burn settled on, 0 if none */
+	int resumed;		/* it did not send the whole payload in one go */
+	int reading;
+	long start;		/* range read back */
+	long end;
+	IHex8Monitor monitor;	/* metrics' own, progress is taken from it */
+	pthread_t worker;
+	int joinable;
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	session_progress_s state;
+	int cancelled;
+} session_s;
+
+int session_init(session_s *s, IHex8 *ih, FILE *out, FILE *err);
+void session_cleanup(session_s *s);
+void session_defaults(session_config_s *c);
+
+int session_submit(session_s *s, IHex8Image *image, const session_config_s *c);
+int session_submit_prepared(session_s *s, session_payload_s *p, const session_config_s *c);
+int session_prepare(session_payload_s *p, IHex8Image *image, const session_config_s *c,
+    FILE *out, FILE *err);
+void session_payload_free(session_payload_s *p);
+int session_read_back(session_s *s, const DeviceProfile *device, long start, long end);
+int session_poll(session_s *s, session_progress_s *p);
+int session_await(session_s *s, double timeout, session_progress_s *p);
+void session_cancel(session_s *s);
+IHex8Image *session_result(session_s *s);
+
+int session_sync(session_s *s);
+uint8_t session_page_bits(const DeviceProfile *device);
+long session_image_size(IHex8Image *image);
+
+#endif	/* session_h */
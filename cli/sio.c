@@ -137,6 +137,10 @@ int sio_open(sio_s *sio)
   t.c_cc[VMIN]  = 0;
   t.c_cc[VTIME] = 10 * sio->info.timeout;
 
+  /* dropping DTR on close resets an Arduino, and with it whatever the
+   * controller kept in RAM for the next run */
+  t.c_cflag &= ~HUPCL;
+
   if (tcsetattr(fd, TCSANOW, &t))
   {
     close(fd);
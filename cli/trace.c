@@ -0,0 +1,404 @@
+/*
+ * trace.c *
+ * capture and replay of controller traffic
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define EVENT_HEADER 9
+
+static int trace_readc(void *ctx);
+static int trace_readln(void *ctx, char *buf, int buflen);
+static int trace_writec(void *ctx, char c);
+static int trace_writeln(void *ctx, const char *s);
+static void trace_pend(trace_s *t, uint8_t kind, const void *data, size_t count);
+static void trace_settle(trace_s *t);
+static void trace_emit(trace_s *t, uint8_t kind, int16_t rc, const void *data,
+    uint16_t length, double at);
+
+static int replay_readc(void *ctx);
+static int replay_readln(void *ctx, char *buf, int buflen);
+static int replay_writec(void *ctx, char c);
+static int replay_writeln(void *ctx, const char *s);
+static trace_event_s *replay_read_event(replay_s *r, uint8_t kind);
+static void replay_wait(replay_s *r, trace_event_s *e);
+static void replay_anchor(replay_s *r, trace_event_s *e);
+
+static double now(void);
+
+IHex8 *trace_wrap(trace_s *t, IHex8 *inner, FILE *fp)
+{
+  memset(t, 0, sizeof(trace_s));
+  t->inner = inner;
+  t->fp = fp;
+  t->last = now();
+  fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), fp);
+  fputc(TRACE_VERSION, fp);
+
+  t->ih.readc = inner->readc != NULL ? trace_readc : NULL;
+  t->ih.readln = inner->readln != NULL ? trace_readln : NULL;
+  t->ih.writec = trace_writec;
+  t->ih.writeln = trace_writeln;
+  t->ih.ctx = t;
+  return &t->ih;
+}
+
+void trace_note(trace_s *t, const char *key, long value)
+{
+  char note[64];
+  int n = snprintf(note, sizeof(note), "%s %ld", key, value);
+  if (n < 0 || n >= (int) sizeof(note)) return;
+  trace_settle(t);
+  trace_emit(t, TRACE_NOTE, 0, note, n, now());
+}
+
+void trace_flush(trace_s *t)
+{
+  trace_settle(t);
+  fflush(t->fp);
+}
+
+void trace_close(trace_s *t)
+{
+  trace_flush(t);
+  fclose(t->fp);
+  t->fp = NULL;
+}
+
+int trace_read_header(FILE *fp)
+{
+  char magic[sizeof(TRACE_MAGIC)];
+  size_t n = strlen(TRACE_MAGIC);
+  if (fread(magic, 1, n, fp) != n || memcmp(magic, TRACE_MAGIC, n) != 0) {
+    return -1;
+  }
+  return fgetc(fp) == TRACE_VERSION ? 0 : -1;
+}
+
+int trace_read_event(FILE *fp, trace_event_s *e)
+{
+  uint8_t h[EVENT_HEADER];
+  if (fread(h, 1, sizeof(h), fp) != sizeof(h)) return -1;
+  e->delta = h[0] | h[1] << 8 | h[2] << 16 | (uint32_t) h[3] << 24;
+  e->kind = h[4];
+  e->rc = (int16_t) (h[5] | h[6] << 8);
+  e->length = h[7] | h[8] << 8;
+  e->data = (uint8_t *) malloc(e->length + 1);
+  if (e->data == NULL) return -1;
+  if (fread(e->data, 1, e->length, fp) != e->length) {
+    free(e->data);
+    return -1;
+  }
+  e->data[e->length] = '\0';
+  return 0;
+}
+
+void trace_print(FILE *f, trace_event_s *e)
+{
+  const char *arrow = e->kind == TRACE_WRITE ? ">" : e->kind == TRACE_NOTE ? "=" : "<";
+  fprintf(f, "%12.6f %s %c", e->at, arrow, e->kind);
+  if (e->kind == TRACE_READ || e->kind == TRACE_READLN) fprintf(f, " %d", e->rc);
+  fputc(' ', f);
+  for (int i = 0; i < e->length; i++) {
+    uint8_t c = e->data[i];
+    if (c == '\n') fputs("\\n", f);
+    else if (c == '\\') fputs("\\\\", f);
+    else if (isprint(c)) fputc(c, f);
+    else fprintf(f, "\\x%02X", c);
+  }
+  fputc('\n', f);
+}
+
+IHex8 *replay_open(replay_s *r, FILE *fp, int realtime)
+{
+  memset(r, 0, sizeof(replay_s));
+  r->realtime = realtime;
+  r->diverged = -1;
+  if (trace_read_header(fp) != 0) {
+    fputs("not a trace file\n", stderr);
+    return NULL;
+  }
+
+  long capacity = 0;
+  long note_capacity = 0;
+  double at = 0;
+  trace_event_s e;
+  while (trace_read_event(fp, &e) == 0) {
+    at += e.delta / 1e6;
+    e.at = at;
+    if (e.kind == TRACE_NOTE) {
+      if (r->note_count == note_capacity) {
+        note_capacity = note_capacity ? 2 * note_capacity : 8;
+        trace_event_s *notes = (trace_event_s *) realloc(r->notes,
+            note_capacity * sizeof(trace_event_s));
+        if (notes == NULL) {
+          free(e.data);
+          replay_close(r);
+          return NULL;
+        }
+        r->notes = notes;
+      }
+      r->notes[r->note_count++] = e;
+      continue;
+    }
+    if (r->count == capacity) {
+      capacity = capacity ? 2 * capacity : 256;
+      trace_event_s *events = (trace_event_s *) realloc(r->events,
+          capacity * sizeof(trace_event_s));
+      if (events == NULL) {
+        free(e.data);
+        replay_close(r);
+        return NULL;
+      }
+      r->events = events;
+    }
+    r->events[r->count++] = e;
+  }
+
+  r->ih.readc = replay_readc;
+  r->ih.readln = replay_readln;
+  r->ih.writec = replay_writec;
+  r->ih.writeln = replay_writeln;
+  r->ih.ctx = r;
+  r->anchor_real = now();
+  return &r->ih;
+}
+
+int replay_note(replay_s *r, const char *key, long *value)
+{
+  /* notes are taken in the order they were captured */
+  size_t n = strlen(key);
+  while (r->noted < r->note_count) {
+    trace_event_s *e = &r->notes[r->noted++];
+    if (strncmp((char *) e->data, key, n) == 0 && e->data[n] == ' ') {
+      *value = strtol((char *) e->data + n + 1, NULL, 10);
+      return 0;
+    }
+  }
+  return -1;
+}
+
+int replay_report(replay_s *r, FILE *f)
+{
+  /* anything the host never wrote counts against it too */
+  for (long i = r->next; i < r->count && r->diverged == -1; i++) {
+    if (r->events[i].kind == TRACE_WRITE) r->diverged = i;
+  }
+  if (r->diverged == -1) {
+    fprintf(f, "Replayed %ld event(s), %ld byte(s) written as captured\n",
+        r->count, r->written);
+    return 0;
+  }
+  fprintf(f, "Replay diverged after %ld matching byte(s) at event %ld:\n",
+      r->written, r->diverged);
+  trace_print(f, &r->events[r->diverged]);
+  return -1;
+}
+
+void replay_close(replay_s *r)
+{
+  for (long i = 0; i < r->count; i++) {
+    free(r->events[i].data);
+  }
+  free(r->events);
+  r->events = NULL;
+  r->count = 0;
+  for (long i = 0; i < r->note_count; i++) {
+    free(r->notes[i].data);
+  }
+  free(r->notes);
+  r->notes = NULL;
+  r->note_count = 0;
+}
+
+static int trace_readc(void *ctx)
+{
+  trace_s *t = (trace_s *) ctx;
+  int c = t->inner->readc(t->inner->ctx);
+  if (c == -1) {
+    trace_settle(t);
+    trace_emit(t, TRACE_READ, -1, NULL, 0, now());
+  }
+  else {
+    uint8_t b = (uint8_t) c;
+    trace_pend(t, TRACE_READ, &b, 1);
+  }
+  return c;
+}
+
+static int trace_readln(void *ctx, char *buf, int buflen)
+{
+  trace_s *t = (trace_s *) ctx;
+  int rc = t->inner->readln(t->inner->ctx, buf, buflen);
+  size_t length = rc >= 0 ? strnlen(buf, buflen) : 0;
+  trace_settle(t);
+  trace_emit(t, TRACE_READLN, (int16_t) rc, buf, length, now());
+  return rc;
+}
+
+static int trace_writec(void *ctx, char c)
+{
+  trace_s *t = (trace_s *) ctx;
+  trace_pend(t, TRACE_WRITE, &c, 1);
+  return t->inner->writec(t->inner->ctx, c);
+}
+
+static int trace_writeln(void *ctx, const char *s)
+{
+  trace_s *t = (trace_s *) ctx;
+  trace_pend(t, TRACE_WRITE, s, strlen(s));
+  trace_pend(t, TRACE_WRITE, "\n", 1);
+  return t->inner->writeln(t->inner->ctx, s);
+}
+
+static void trace_pend(trace_s *t, uint8_t kind, const void *data, size_t count)
+{
+  /* runs of single bytes are coalesced, a record costs one event, not 45 */
+  const uint8_t *p = (const uint8_t *) data;
+  while (count > 0) {
+    if (t->kind != kind || t->pending_length == TRACE_CHUNK) {
+      trace_settle(t);
+      t->kind = kind;
+      t->pending_at = now();
+    }
+    size_t n = TRACE_CHUNK - t->pending_length;
+    if (n > count) n = count;
+    memcpy(t->pending + t->pending_length, p, n);
+    t->pending_length += n;
+    p += n;
+    count -= n;
+  }
+}
+
+static void trace_settle(trace_s *t)
+{
+  if (t->kind == 0) return;
+  trace_emit(t, t->kind, 0, t->pending, t->pending_length, t->pending_at);
+  t->kind = 0;
+  t->pending_length = 0;
+}
+
+static void trace_emit(trace_s *t, uint8_t kind, int16_t rc, const void *data,
+    uint16_t length, double at)
+{
+  double delta = (at - t->last) * 1e6;
+  uint32_t us = delta < 0 ? 0 : delta > 0xFFFFFFFFu ? 0xFFFFFFFFu : (uint32_t) delta;
+  t->last = at;
+
+  uint8_t h[EVENT_HEADER] = {
+    us & 0xFF, us >> 8 & 0xFF, us >> 16 & 0xFF, us >> 24 & 0xFF,
+    kind, rc & 0xFF, rc >> 8 & 0xFF, length & 0xFF, length >> 8 & 0xFF
+  };
+  fwrite(h, 1, sizeof(h), t->fp);
+  fwrite(data, 1, length, t->fp);
+}
+
+static int replay_readc(void *ctx)
+{
+  replay_s *r = (replay_s *) ctx;
+  trace_event_s *e = replay_read_event(r, TRACE_READ);
+  if (e == NULL) return -1;
+  if (e->length == 0) {
+    r->next++;
+    return e->rc;
+  }
+  int c = e->data[r->offset++];
+  if (r->offset == e->length) {
+    r->next++;
+    r->offset = 0;
+  }
+  return c;
+}
+
+static int replay_readln(void *ctx, char *buf, int buflen)
+{
+  replay_s *r = (replay_s *) ctx;
+  trace_event_s *e = replay_read_event(r, TRACE_READLN);
+  if (e == NULL) return -1;
+  r->next++;
+  if (buflen > 0) {
+    int n = e->length < buflen ? e->length : buflen - 1;
+    memcpy(buf, e->data, n);
+    buf[n] = '\0';
+  }
+  return e->rc;
+}
+
+static int replay_writec(void *ctx, char c)
+{
+  replay_s *r = (replay_s *) ctx;
+  if (r->diverged != -1) return 1;
+
+  trace_event_s *e = r->next < r->count ? &r->events[r->next] : NULL;
+  if (e == NULL || e->kind != TRACE_WRITE || e->data[r->offset] != (uint8_t) c) {
+    r->diverged = r->next;
+    return 1;
+  }
+  if (r->offset == 0) replay_anchor(r, e);
+  r->written++;
+  if (++r->offset == e->length) {
+    r->next++;
+    r->offset = 0;
+  }
+  return 1;
+}
+
+static int replay_writeln(void *ctx, const char *s)
+{
+  while (*s != '\0') replay_writec(ctx, *s++);
+  replay_writec(ctx, '\n');
+  return 0;
+}
+
+static trace_event_s *replay_read_event(replay_s *r, uint8_t kind)
+{
+  /* the host reading early means it skipped bytes the capture has */
+  if (r->next < r->count && r->events[r->next].kind == TRACE_WRITE) {
+    if (r->diverged == -1) r->diverged = r->next;
+    while (r->next < r->count && r->events[r->next].kind == TRACE_WRITE) {
+      r->next++;
+    }
+    r->offset = 0;
+  }
+  if (r->next >= r->count || r->events[r->next].kind != kind) return NULL;
+
+  trace_event_s *e = &r->events[r->next];
+  if (r->offset == 0) {
+    replay_wait(r, e);
+    replay_anchor(r, e);
+  }
+  return e;
+}
+
+static void replay_wait(replay_s *r, trace_event_s *e)
+{
+  if (!r->realtime) return;
+
+  /* keep the captured gap since the last exchange, not the absolute
+   * schedule, so a slower host still sees the controller's latency */
+  double due = r->anchor_real + (e->at - r->anchor_at);
+  double wait = due - now();
+  if (wait > 0) {
+    struct timespec ts = { (time_t) wait, (long) ((wait - (time_t) wait) * 1e9) };
+    nanosleep(&ts, NULL);
+  }
+}
+
+static void replay_anchor(replay_s *r, trace_event_s *e)
+{
+  r->anchor_real = now();
+  r->anchor_at = e->at;
+}
+
+static double now(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
@@ -0,0 +1,70 @@
+#ifndef trace_h
+#define trace_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include "../ihex8.h"
+
+#define TRACE_MAGIC "IH8T"
+#define TRACE_VERSION 1
+#define TRACE_CHUNK 256
+
+#define TRACE_READ 'r'		/* bytes from readc, rc -1 on timeout */
+#define TRACE_READLN 'l'	/* one line from readln, rc as returned */
+#define TRACE_WRITE 'w'		/* bytes from writec and writeln */
+#define TRACE_NOTE 'n'		/* "key value" the host chose, not traffic */
+
+typedef struct
+{
+	uint32_t delta;		/* microseconds since the previous event */
+	uint8_t kind;
+	int16_t rc;
+	uint16_t length;
+	uint8_t *data;
+	double at;		/* seconds since the trace started, on reading */
+} trace_event_s;
+
+typedef struct
+{
+	IHex8 ih;		/* the decorated transport */
+	IHex8 *inner;
+	FILE *fp;
+	double last;
+	uint8_t kind;		/* kind of the event being coalesced, 0 if none */
+	double pending_at;
+	uint16_t pending_length;
+	uint8_t pending[TRACE_CHUNK];
+} trace_s;
+
+typedef struct
+{
+	IHex8 ih;		/* transport that plays back a trace */
+	trace_event_s *events;
+	long count;
+	long next;		/* next event to serve */
+	uint16_t offset;	/* bytes already served from it */
+	int realtime;		/* reproduce the recorded delays */
+	double anchor_real;	/* when the last exchange happened here */
+	double anchor_at;	/* and when it happened in the trace */
+	trace_event_s *notes;	/* kept apart from the traffic */
+	long note_count;
+	long noted;		/* notes already taken */
+	long written;		/* bytes written that matched the trace */
+	long diverged;		/* write event that first differed, or -1 */
+} replay_s;
+
+IHex8 *trace_wrap(trace_s *t, IHex8 *inner, FILE *fp);
+void trace_note(trace_s *t, const char *key, long value);
+void trace_flush(trace_s *t);
+void trace_close(trace_s *t);
+
+int trace_read_event(FILE *fp, trace_event_s *e);
+int trace_read_header(FILE *fp);
+void trace_print(FILE *f, trace_event_s *e);
+
+IHex8 *replay_open(replay_s *r, FILE *fp, int realtime);
+int replay_note(replay_s *r, const char *key, long *value);
+int replay_report(replay_s *r, FILE *f);
+void replay_close(replay_s *r);
+
+#endif	/* trace_h */
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <getopt.h>
+#include "mio.h"
+#include "trace.h"
+#include "../ihex8.h"
+
+typedef struct
+{
+  int controller;
+} options_s;
+
+options_s options = { 0 };
+
+int parse_options(const int argc, const char* argv[]);
+int dump_trace(replay_s* r);
+int replay_controller(replay_s* r);
+int is_ack(const char* line);
+const char* next_ack(replay_s* r, long* i);
+
+void count_record(IHex8Record* rec, void* ctx);
+int accept_command(char* line, char* reply, int replylen, void* ctx);
+
+int main(const int argc, const char* argv[]) {
+  if (parse_options(argc, argv) != 0) return 1;
+
+  FILE* fp = fopen(argv[optind], "rb");
+  if (fp == NULL) {
+    perror(argv[optind]);
+    return 1;
+  }
+  replay_s replay;
+  IHex8* ih = replay_open(&replay, fp, 0);
+  fclose(fp);
+  if (ih == NULL) return 1;
+
+  int rc = options.controller ? replay_controller(&replay) : dump_trace(&replay);
+  replay_close(&replay);
+  return rc;
+}
+
+int parse_options(const int argc, const char* argv[]) {
+  static struct option longopts[] = {
+    { "controller", no_argument, NULL, 'c' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  int c;
+  while ((c = getopt_long(argc, (char* const*) argv, "c", longopts, NULL)) != -1) {
+    switch (c) {
+      case 'c':
+        options.controller = 1;
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-c] trace\n", argv[0]);
+    fputs("  prints a trace captured by sendihex8 --trace\n", stderr);
+    fputs("  -c, --controller  replay its host side into the controller logic\n", stderr);
+    fputs("                    and compare the acks against the captured ones\n", stderr);
+    return -1;
+  }
+  return 0;
+}
+
+int dump_trace(replay_s* r) {
+  /* notes are kept apart from the traffic, put them back in time order */
+  long note = 0;
+  for (long i = 0; i < r->count; i++) {
+    while (note < r->note_count && r->notes[note].at <= r->events[i].at) {
+      trace_print(stdout, &r->notes[note++]);
+    }
+    trace_print(stdout, &r->events[i]);
+  }
+  while (note < r->note_count) {
+    trace_print(stdout, &r->notes[note++]);
+  }
+  return 0;
+}
+
+int replay_controller(replay_s* r) {
+  /* the host side of the trace is exactly what the controller read */
+  size_t size = 0;
+  for (long i = 0; i < r->count; i++) {
+    if (r->events[i].kind == TRACE_WRITE) size += r->events[i].length;
+  }
+  char* input = (char*) malloc(size + 1);
+  if (input == NULL) return 1;
+  size = 0;
+  for (long i = 0; i < r->count; i++) {
+    if (r->events[i].kind != TRACE_WRITE) continue;
+    memcpy(input + size, r->events[i].data, r->events[i].length);
+    size += r->events[i].length;
+  }
+
+  mio_s mio;
+  IHex8 ih;
+  long records = 0;
+  mio_init(&mio, input, size);
+  mio_ihex8(&mio, &ih);
+  IHex8Handler handler = { count_record, accept_command, &records, NULL };
+  while (mio.inpos < mio.inlen) {
+    ihex8ReceiveWith(&ih, &handler);
+  }
+
+  /* only record acks depend on the protocol logic alone; sync, command
+   * replies and dumps come from the device */
+  long acks = 0;
+  long differ = 0;
+  long captured = 0;
+  char* line = mio.out;
+  char* end = mio.out + mio.outlen;
+  while (line < end) {
+    char* eol = memchr(line, '\n', end - line);
+    if (eol == NULL) eol = end;
+    *eol = '\0';
+    if (is_ack(line)) {
+      acks++;
+      const char* expected = next_ack(r, &captured);
+      if (expected == NULL || strcmp(line, expected) != 0) {
+        /* a NAK for bytes the host sent intact points at the line */
+        fprintf(stdout, "ack %ld differs: controller says '%s', trace has '%s'\n",
+            acks, line, expected != NULL ? expected : "nothing");
+        differ++;
+      }
+    }
+    line = eol + 1;
+  }
+
+  fprintf(stdout, "%zu byte(s) replayed, %ld record(s) stored, %ld of %ld ack(s) differ\n",
+      size, records, differ, acks);
+  mio_cleanup(&mio);
+  free(input);
+  return differ > 0;
+}
+
+int is_ack(const char* line) {
+  if (strncmp(line, MSG_NAK " ", strlen(MSG_NAK) + 1) == 0) return 1;
+  if (strcmp(line, MSG_END) == 0) return 1;
+  if (strncmp(line, MSG_OK " ", strlen(MSG_OK) + 1) != 0) return 0;
+  const char* p = line + strlen(MSG_OK) + 1;
+  for (int i = 0; i < 4; i++) {
+    if (!isxdigit((unsigned char) p[i])) return 0;
+  }
+  return p[4] == '\0';
+}
+
+const char* next_ack(replay_s* r, long* i) {
+  for (; *i < r->count; (*i)++) {
+    trace_event_s* e = &r->events[*i];
+    if (e->kind == TRACE_READLN && is_ack((const char*) e->data)) {
+      return (const char*) r->events[(*i)++].data;
+    }
+  }
+  return NULL;
+}
+
+void count_record(IHex8Record* rec, void* ctx) {
+  (*(long*) ctx)++;
+}
+
+int accept_command(char* line, char* reply, int replylen, void* ctx) {
+  return 0;
+}
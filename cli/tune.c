@@ -0,0 +1,129 @@
+/*
+ * tune.c *
+ * pick record size and send window from how the link behaves
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tune.h"
+#include "metrics.h"
+
+static int probe(tune_s *t, IHex8 *ih, IHex8Image *payload, IHex8Monitor *monitor);
+static IHex8Record *skip_to(IHex8Record *rex, long address);
+static double rate(tune_probe_s *p);
+
+int tune_init(tune_s *t, uint8_t max_size, uint8_t size, uint8_t window)
+{
+  memset(t, 0, sizeof(tune_s));
+  t->max_size = max_size;
+  t->size = size;
+  t->window.limit = window > 0 ? window : TUNE_WINDOW;
+  t->window.size = 1;
+  return 0;
+}
+
+long tune_slack(tune_s *t)
+{
+  /* a record resent after a NAK can land behind pages the controller
+   * has already committed, so a resume backs up by a full window */
+  uint8_t size = t->size > 0 ? t->size : t->max_size;
+  return t->window.limit > 1 ? (long) t->window.limit * size : 0;
+}
+
+int tune_send(tune_s *t, IHex8 *ih, IHex8Image *payload, IHex8Record *rex,
+    long start, IHex8Monitor *monitor)
+{
+  t->cursor = start;
+  if (t->size == 0 && probe(t, ih, payload, monitor) != 0) return -1;
+
+  int rc;
+  if (rex != NULL) {
+    rc = ihex8SendWindow(skip_to(rex, t->cursor), NULL, ih, monitor, &t->window);
+  }
+  else {
+    IHex8Record *built = ihex8ImageRecords(payload, t->size);
+    rc = ihex8SendWindow(skip_to(built, t->cursor), NULL, ih, monitor, &t->window);
+    ihex8Free(built);
+  }
+  if (rc != 0) return -1;
+  return ihex8SendWith(NULL, ih, monitor);
+}
+
+void tune_report(tune_s *t, FILE *f)
+{
+  if (t->count > 0) {
+    fprintf(f, "Using %d-byte records (", t->size);
+    for (int i = 0; i < t->count; i++) {
+      fprintf(f, "%s%d: %.0f B/s", i ? ", " : "", t->probes[i].size, rate(&t->probes[i]));
+    }
+    fputs(")\n", f);
+  }
+  if (t->window.limit > 1 && t->window.peak > 0) {
+    fprintf(f, "Up to %d record(s) in flight, backed off %ld time(s)\n",
+        t->window.peak, t->window.backoffs);
+  }
+}
+
+static int probe(tune_s *t, IHex8 *ih, IHex8Image *payload, IHex8Monitor *monitor)
+{
+  /* stop and wait, so each size is timed on the link alone */
+  IHex8Window window = t->window;
+  t->window.size = 1;
+  t->window.limit = 1;
+
+  int rc = 0;
+  for (int size = TUNE_MIN_SIZE; size <= t->max_size && t->count < TUNE_SIZES; size *= 2) {
+    IHex8Record *rex = ihex8ImageRecords(payload, size);
+    IHex8Record *top = skip_to(rex, t->cursor);
+    IHex8Record *end = top;
+    IHex8Record *prev = NULL;
+    long bytes = 0;
+    /* finish the page, records of another size will start the next */
+    while (end != NULL && (bytes < TUNE_PROBE_BYTES || (prev != NULL
+        && end->address >> payload->pageBits == prev->address >> payload->pageBits))) {
+      bytes += end->length;
+      prev = end;
+      end = end->next;
+    }
+    if (bytes == 0) {
+      ihex8Free(rex);
+      break;
+    }
+
+    double started = metrics_now();
+    rc = ihex8SendWindow(top, end, ih, monitor, &t->window);
+    tune_probe_s *p = &t->probes[t->count++];
+    p->size = size;
+    p->bytes = bytes;
+    p->seconds = metrics_now() - started;
+    t->cursor = end != NULL ? end->address : 0x10000;
+    ihex8Free(rex);
+    if (rc != 0) break;
+  }
+
+  t->window = window;
+  t->size = t->max_size;
+  for (int i = 0, best = -1; i < t->count; i++) {
+    if (best == -1 || rate(&t->probes[i]) > rate(&t->probes[best])) {
+      best = i;
+      t->size = t->probes[i].size;
+    }
+  }
+  if (t->settle > 0) t->size = t->settle;
+  return rc;
+}
+
+static IHex8Record *skip_to(IHex8Record *rex, long address)
+{
+  while (rex != NULL && rex->address + rex->length <= address) {
+    rex = rex->next;
+  }
+  return rex;
+}
+
+static double rate(tune_probe_s *p)
+{
+  return p->seconds > 0 ? p->bytes / p->seconds : 0;
+}
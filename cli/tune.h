@@ -0,0 +1,36 @@
+#ifndef tune_h
+#define tune_h
+
+#include <stdio.h>
+#include "../ihex8.h"
+
+#define TUNE_SIZES 4
+#define TUNE_MIN_SIZE 16
+#define TUNE_PROBE_BYTES 256	/* sent at each candidate size */
+#define TUNE_WINDOW 8		/* records in flight unless told otherwise */
+
+typedef struct
+{
+	uint8_t size;
+	long bytes;
+	double seconds;
+} tune_probe_s;
+
+typedef struct
+{
+	IHex8Window window;
+	uint8_t size;		/* record size, 0 until probed */
+	uint8_t settle;		/* size kept after probing, 0 for the fastest */
+	uint8_t max_size;
+	tune_probe_s probes[TUNE_SIZES];
+	int count;
+	long cursor;		/* first address not yet sent */
+} tune_s;
+
+int tune_init(tune_s *t, uint8_t max_size, uint8_t size, uint8_t window);
+long tune_slack(tune_s *t);
+int tune_send(tune_s *t, IHex8 *ih, IHex8Image *payload, IHex8Record *rex,
+    long start, IHex8Monitor *monitor);
+void tune_report(tune_s *t, FILE *f);
+
+#endif	/* tune_h */
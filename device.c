@@ -0,0 +1,42 @@
+#include <stddef.h>
+#include <ctype.h>
+#include "device.h"
+
+static const DeviceProfile profiles[] = {
+  { "28C64",  8192,  6, 10000, 150, 1, 1 },
+  { "28C256", 32768, 6, 10000, 150, 1, 0 },
+  { "28C16",  2048,  0, 1000,  0,   0, 0 },
+};
+
+#define PROFILE_COUNT (sizeof(profiles) / sizeof(profiles[0]))
+
+static int matches(const char* name, const char* s);
+
+const DeviceProfile* deviceDefault(void) {
+  return &profiles[0];
+}
+
+const DeviceProfile* deviceFind(const char* name) {
+  if (toupper((unsigned char) name[0]) == 'A' 
+      && toupper((unsigned char) name[1]) == 'T') {
+    name += 2;
+  }
+  for (size_t i = 0; i < PROFILE_COUNT; i++) {
+    if (matches(profiles[i].name, name)) return &profiles[i];
+  }
+  return NULL;
+}
+
+const DeviceProfile* deviceAt(int index) {
+  if (index < 0 || (size_t) index >= PROFILE_COUNT) return NULL;
+  return &profiles[index];
+}
+
+static int matches(const char* name, const char* s) {
+  while (*name != '\0' && toupper((unsigned char) *s) == *name) {
+    name++;
+    s++;
+  }
+  /* accept a trailing speed/variant suffix such as 28C64B or 28C256-15 */
+  return *name == '\0' && !isdigit((unsigned char) *s);
+}
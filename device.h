@@ -0,0 +1,33 @@
+#ifndef device_h
+#define device_h
+
+#include <stdint.h>
+
+#define DEVICE_MAX_PAGE_BITS 6
+#define DEVICE_MAX_PAGE_SIZE (1<<DEVICE_MAX_PAGE_BITS)
+
+typedef struct device_profile_t {
+  const char* name;
+  uint32_t capacity;            /* size in bytes */
+  uint8_t pageBits;             /* log2 of page size, 0 if no page mode */
+  uint16_t writeCycle;          /* tWC in microseconds */
+  uint16_t byteLoadCycle;       /* tBLC in microseconds */
+  uint8_t sdp;                  /* may come write-protected; disabled before writing */
+  uint8_t chipErase;            /* supports the software chip erase sequence */
+} DeviceProfile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const DeviceProfile* deviceDefault(void);
+
+const DeviceProfile* deviceFind(const char* name);
+
+const DeviceProfile* deviceAt(int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* device_h */
@@ -1,14 +1,13 @@
 
 #include <stdio.h>
-#include <ctype.h>
 #include <SPI.h>
 #include "ihex8.h"
+#include "device.h"
 
 #define TIMEOUT 30000
-#define DUMP_FORMAT "%04x  %02x %02x %02x %02x %02x %02x %02x %02x  %02x %02x %02x %02x %02x %02x %02x %02x  %c%c%c%c%c%c%c%c %c%c%c%c%c%c%c%c"
-
-#define dch(b) (isprint(b) ? b : '.')
-
+#define KEEPALIVE 250           /* ms between INFO lines during long commands */
+#define CHIP_ERASE_TIME 20      /* tEC in ms */
+#define FILL_PATTERN_MAX 8
 #define SCK 13
 #define MISO 12
 #define MOSI 11
@@ -20,23 +19,57 @@
 #define EEPROM_OUT_ENABLE 5
 #define EEPROM_WRITE_ENABLE 4
 
-#define PAGE_BITS 6
+#define PAGE_BITS DEVICE_MAX_PAGE_BITS
 #define PAGE_SIZE (1<<PAGE_BITS)
 #define PAGE_MASK (PAGE_SIZE-1)
+/* sendihex8 merges the file into an image and sends it a page at a time,
+ * so each page is written once whatever the file's order; the slots only
+ * absorb small disorder, such as a resent record or a raw stream jumping
+ * between a few pages. Input spread over more pages than there are slots
+ * still writes pages more than once. */
+#define PAGE_SLOTS 4            /* also the most pages one record may span */
 
 typedef struct {
   uint8_t data[PAGE_SIZE];      /* page data */
   uint16_t address;             /* k-bit page address */
-  uint8_t offsets[PAGE_SIZE];   /* (16-k)-bit page offsets */
-  uint16_t count;               /* number of offsets */
+  uint8_t present[PAGE_SIZE/8]; /* bitmap of (16-k)-bit page offsets */
+  uint8_t count;                /* number of offsets present */
+  uint8_t pending;              /* first offset of uncommitted data */
+  uint8_t pendingLength;        /* length of uncommitted data */
 } Page;
 
+typedef struct {
+  Page slots[PAGE_SLOTS];       /* write-back page cache */
+  uint16_t used[PAGE_SLOTS];    /* clock value at last claim, for LRU */
+  uint16_t clock;
+} PageCache;
+
 int programEEPROM(IHex8* ih);
-void dumpEEPROM();
-void storeRecord(IHex8Record* record, void* ctx);
-void storeInPage(uint16_t address, uint8_t data, Page* page);
+int runCommand(char* line, char* reply, int replylen, void* ctx);
+uint8_t* claimInPage(uint16_t address, uint8_t* length, void* ctx);
+void commitPage(void* ctx);
+void discardPage(void* ctx);
+const char* checkPages(uint8_t final, void* ctx);
+boolean isPresent(Page* page, uint8_t offset);
+Page* findSlot(PageCache* cache, uint16_t pageAddress);
+Page* joinSlot(PageCache* cache, uint16_t pageAddress, uint8_t offset, uint8_t length);
+boolean reserveSlots(PageCache* cache, uint16_t address, uint8_t length);
+Page* freeSlot(PageCache* cache);
+Page* oldestSlot(PageCache* cache);
+void flushCache(PageCache* cache);
 void writePage(Page* page);
+uint8_t loadPage(Page* page);
+long verifyPage(Page* page);
+void eraseChip();
+void unprotectChip();
+long fillRange(unsigned long start, unsigned long end, 
+    const uint8_t* pattern, uint8_t length);
+long fillPage(unsigned long start, unsigned long end, 
+    const uint8_t* pattern, uint8_t length);
+uint16_t crcRange(unsigned long start, unsigned long end);
+void readRange(unsigned long start, unsigned long end, char* hex);
 void writeByte(uint8_t data, uint16_t addr);
+void waitMicros(unsigned long us);
 void sendByte(uint8_t data, uint16_t addr);
 uint8_t recvByte(uint16_t addr);
 
@@ -50,11 +83,16 @@ IHex8 ihex8 = {
   .readln = NULL,
   .writec = writec,
   .writeln = writeln,
-  .ctx = NULL
+  .ctx = NULL,
+  .report = NULL
 };
 
-boolean done;
-uint16_t address;
+boolean started;                        /* a burn has sent records or commands */
+unsigned long resumeAddress;            /* next address after last page written; lost on reset */
+unsigned long verified;                 /* record bytes read back intact this burn */
+long failedAddress;                     /* first that did not read back, or -1 */
+const DeviceProfile* device;
+boolean unprotected;                    /* SDP was disabled for this burn and device */
 
 void setup() {
   pinMode(SCK, OUTPUT);
@@ -77,110 +115,464 @@ void setup() {
   digitalWrite(EEPROM_OUT_ENABLE, HIGH);
   digitalWrite(DATA_OUT_ENABLE, HIGH);
 
+  device = deviceDefault();
   Serial.begin(115200);
 }
 
 void loop() {
-  while (!done) {
-    done = programEEPROM(&ihex8);
-    if (!done) {
-      for (int i = 0; i < 8; i++) {
-        Serial.println("EEPROM programming failed");
-      }
-    }
-    else {
-      Serial.println("EEPROM programming completed");
-      Serial.println("OK");      
-      dumpEEPROM();
-      Serial.println("OK");
-    }
-  }
+  /* stay ready for the next burn; an idle timeout is not a failure */
+  started = false;
+  verified = 0;
+  boolean done = programEEPROM(&ihex8);
   if (done) {
+    /* every page was read back as it was written, no dump to compare */
+    char line[32];
+    snprintf(line, sizeof(line), "%s %lu", MSG_VERIFIED, verified);
+    Serial.println("EEPROM programming completed");
+    Serial.println("OK");      
+    Serial.println(line);
+    Serial.println("OK");
     digitalWrite(SCK, HIGH);
     delay(125);
     digitalWrite(SCK, LOW);
-    sendByte(0, address++);
-    delay(125);
+  }
+  else if (started) {
+    for (int i = 0; i < 8; i++) {
+      Serial.println("EEPROM programming failed");
+    }
   }
 }
 
 int programEEPROM(IHex8* ih) {
-  Page page;
-  memset(&page, 0, sizeof(Page));
+  PageCache cache;
+  memset(&cache, 0, sizeof(PageCache));
+  failedAddress = -1;
+  unprotected = false;
   digitalWrite(EEPROM_OUT_ENABLE, HIGH);
   digitalWrite(DATA_OUT_ENABLE, LOW);
-  int rc = ihex8ReceiveAndStore(ih, &page, storeRecord);
-  if (page.count != 0) {
-    writePage(&page);
-  }
+  IHex8Handler handler = { NULL, runCommand, &cache, NULL, 
+      claimInPage, commitPage, discardPage, checkPages };
+  int rc = ihex8ReceiveWith(ih, &handler);
+  flushCache(&cache);
   digitalWrite(DATA_OUT_ENABLE, HIGH);
   digitalWrite(EEPROM_OUT_ENABLE, LOW);
   return rc;   
 }
 
-void dumpEEPROM() {
-  char cbuf[80];
-  uint8_t dbuf[16];
-  for (uint16_t i = 0; i < (1024 / 256); i++) {
-    for (uint8_t j = 0; j < (256 / 16); j++) {
-      uint16_t addr = 256*i + 16*j;
-      for (uint8_t k = 0; k < 16; k++) {
-        uint8_t data = recvByte(addr + k);
-        dbuf[k] = data;
+int runCommand(char* line, char* reply, int replylen, void* ctx) {
+  char* verb = strtok(line, " ");
+  char* arg = strtok(NULL, " ");
+  if (verb == NULL) verb = line;
+
+  /* choosing the part or reading the chip back is not a burn of its own */
+  if (strcmp(verb, CMD_CRC) == 0) {
+    flushCache((PageCache*) ctx);
+    snprintf(reply, replylen, "%04X", crcRange(0, device->capacity));
+    return 0;
+  }
+
+  if (strcmp(verb, CMD_READ) == 0) {
+    unsigned long start = arg != NULL ? strtoul(arg, NULL, 16) : 0;
+    if (start >= device->capacity) {
+      snprintf(reply, replylen, "bad address %s", arg != NULL ? arg : "");
+      return -1;
+    }
+    unsigned long end = start + IHEX8_READ_LENGTH;
+    if (end > device->capacity) end = device->capacity;
+    flushCache((PageCache*) ctx);
+    int n = snprintf(reply, replylen, "%04lX ", start);
+    readRange(start, end, reply + n);
+    return 0;
+  }
+
+  if (strcmp(verb, CMD_DEVICE) == 0) {
+    if (arg != NULL) {
+      const DeviceProfile* profile = deviceFind(arg);
+      if (profile == NULL) {
+        snprintf(reply, replylen, "unknown device %s", arg);
+        return -1;
       }
-      
-      snprintf(cbuf, sizeof(cbuf), DUMP_FORMAT, addr, 
-          dbuf[0], dbuf[1], dbuf[2], dbuf[3], 
-          dbuf[4], dbuf[5], dbuf[6], dbuf[7],
-          dbuf[8], dbuf[9], dbuf[10], dbuf[11], 
-          dbuf[12], dbuf[13], dbuf[14], dbuf[15],
-          dch(dbuf[0]), dch(dbuf[1]), dch(dbuf[2]), dch(dbuf[3]), 
-          dch(dbuf[4]), dch(dbuf[5]), dch(dbuf[6]), dch(dbuf[7]),
-          dch(dbuf[8]), dch(dbuf[9]), dch(dbuf[10]), dch(dbuf[11]), 
-          dch(dbuf[12]), dch(dbuf[13]), dch(dbuf[14]), dch(dbuf[15]));
-      Serial.println(cbuf);
+      flushCache((PageCache*) ctx);
+      device = profile;
+      unprotected = false;
     }
-    Serial.println(" ");
+    snprintf(reply, replylen, "%s", device->name);
+    return 0;
+  }
+  started = true;
+
+  if (strcmp(verb, CMD_RESUME) == 0) {
+    if (arg != NULL) {
+      resumeAddress = strtoul(arg, NULL, 16);
+    }
+    snprintf(reply, replylen, "%04lX", resumeAddress);
+    return 0;
   }
-}
 
-void storeRecord(IHex8Record* record, void* ctx) {
-  for (uint8_t i = 0; i < record->length; i++) {
-    storeInPage(record->address + i, record->data[i], (Page*) ctx);
+  if (strcmp(verb, CMD_ERASE) == 0) {
+    flushCache((PageCache*) ctx);
+    if (device->chipErase) {
+      eraseChip();
+    }
+    else {
+      const uint8_t erased = 0xFF;
+      long failed = fillRange(0, device->capacity, &erased, 1);
+      if (failed != -1) {
+        snprintf(reply, replylen, "verify failed at %04lX", failed);
+        return -1;
+      }
+    }
+    return 0;
   }
+
+  if (strcmp(verb, CMD_FILL) == 0) {
+    char* last = strtok(NULL, " ");
+    char* hex = strtok(NULL, " ");
+    if (arg == NULL || last == NULL || hex == NULL) {
+      snprintf(reply, replylen, "usage: %s start end pattern", CMD_FILL);
+      return -1;
+    }
+    unsigned long start = strtoul(arg, NULL, 16);
+    unsigned long end = strtoul(last, NULL, 16);
+    if (start >= end || end > device->capacity) {
+      snprintf(reply, replylen, "bad range %s-%s", arg, last);
+      return -1;
+    }
+
+    uint8_t pattern[FILL_PATTERN_MAX];
+    uint8_t length = 0;
+    while (hex[2*length] != '\0' && length < FILL_PATTERN_MAX) {
+      char byte[3] = { hex[2*length], hex[2*length+1], '\0' };
+      char* stop;
+      pattern[length] = strtoul(byte, &stop, 16);
+      if (byte[1] == '\0' || *stop != '\0') {
+        snprintf(reply, replylen, "bad pattern %s", hex);
+        return -1;
+      }
+      length++;
+    }
+    if (hex[2*length] != '\0') {
+      snprintf(reply, replylen, "pattern longer than %d bytes", FILL_PATTERN_MAX);
+      return -1;
+    }
+
+    flushCache((PageCache*) ctx);
+    long failed = fillRange(start, end, pattern, length);
+    if (failed != -1) {
+      snprintf(reply, replylen, "verify failed at %04lX", failed);
+      return -1;
+    }
+    snprintf(reply, replylen, "%04lX", end);
+    return 0;
+  }
+
+  snprintf(reply, replylen, "unknown command %s", verb);
+  return -1;
 }
 
-void storeInPage(uint16_t address, uint8_t data, Page* page) {
+uint8_t* claimInPage(uint16_t address, uint8_t* length, void* ctx) {
+  PageCache* cache = (PageCache*) ctx;
+  started = true;
   uint16_t pageAddress = address >> PAGE_BITS;
-  if (pageAddress != page->address) {
-    writePage(page);
-    page->address = pageAddress;
+  uint8_t offset = address & PAGE_MASK;
+
+  /* the data streams in right after this returns and none of it may be
+   * written before the checksum, so the first claim of a record makes
+   * room for every page it spans; *length is still the whole record */
+  boolean claiming = false;
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    if (cache->slots[i].pendingLength != 0) claiming = true;
   }
+  if (!claiming && !reserveSlots(cache, address, *length)) return NULL;
 
-  uint8_t offset = address & PAGE_MASK;
-  page->data[offset] = data;
+  if (*length > PAGE_SIZE - offset) {
+    *length = PAGE_SIZE - offset;
+  }
+  /* a record that rewrites cached bytes lands in a free slot and the
+   * older copy goes out when the record commits */
+  Page* page = joinSlot(cache, pageAddress, offset, *length);
+  if (page == NULL) page = freeSlot(cache);
+  if (page == NULL) return NULL;
+
+  cache->used[page - cache->slots] = ++cache->clock;
+  page->address = pageAddress;
+  page->pending = offset;
+  page->pendingLength = *length;
+  return page->data + offset;
+}
+
+void commitPage(void* ctx) {
+  PageCache* cache = (PageCache*) ctx;
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    Page* page = &cache->slots[i];
+    if (page->pendingLength == 0) continue;
+    for (uint8_t j = 0; j < PAGE_SLOTS; j++) {
+      Page* older = &cache->slots[j];
+      if (older != page && older->address == page->address) writePage(older);
+    }
+    for (uint8_t j = 0; j < page->pendingLength; j++) {
+      uint8_t offset = page->pending + j;
+      if (!isPresent(page, offset)) {
+        page->present[offset>>3] |= 1<<(offset & 7);
+        page->count++;
+      }
+    }
+    page->pendingLength = 0;
+  }
+  /* write back before the ack, so the next record finds a slot free */
+  if (freeSlot(cache) == NULL) writePage(oldestSlot(cache));
+}
+
+void discardPage(void* ctx) {
+  PageCache* cache = (PageCache*) ctx;
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    cache->slots[i].pendingLength = 0;
+  }
+}
+
+const char* checkPages(uint8_t final, void* ctx) {
+  static char fault[32];
+  if (final) flushCache((PageCache*) ctx);
+  if (failedAddress == -1) return NULL;
+  snprintf(fault, sizeof(fault), "verify failed at %04lX", failedAddress);
+  return fault;
+}
+
+boolean isPresent(Page* page, uint8_t offset) {
+  return (page->present[offset>>3]>>(offset & 7)) & 1;
+}
+
+Page* findSlot(PageCache* cache, uint16_t pageAddress) {
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    Page* page = &cache->slots[i];
+    if (page->address == pageAddress && page->count != 0) return page;
+  }
+  return NULL;
+}
 
-  uint16_t i = 0;
-  while (i < page->count && page->offsets[i] != offset) {
-    i++;
+Page* joinSlot(PageCache* cache, uint16_t pageAddress, uint8_t offset, uint8_t length) {
+  /* the cached page, if the data does not overlap what it holds */
+  Page* page = findSlot(cache, pageAddress);
+  for (uint8_t i = 0; i < length && page != NULL; i++) {
+    if (isPresent(page, offset + i)) page = NULL;
   }
+  return page;
+}
 
-  if (i == page->count) {
-    if (page->count == PAGE_SIZE) {
-      writePage(page);
+boolean reserveSlots(PageCache* cache, uint16_t address, uint8_t length) {
+  /* writes the least recently used pages until each page of the record
+   * has a slot; false if the record spans more pages than there are */
+  while (true) {
+    uint8_t needed = 0;
+    unsigned long end = (unsigned long) address + length;
+    for (unsigned long at = address; at < end; ) {
+      uint8_t offset = at & PAGE_MASK;
+      uint8_t n = end - at < (unsigned long) (PAGE_SIZE - offset) 
+          ? end - at : PAGE_SIZE - offset;
+      if (joinSlot(cache, at >> PAGE_BITS, offset, n) == NULL) needed++;
+      at += n;
+    }
+    uint8_t available = 0;
+    for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+      if (cache->slots[i].count == 0) available++;
     }
-    page->offsets[i] = offset;
-    page->count++;
+    if (available >= needed) return true;
+
+    Page* oldest = oldestSlot(cache);
+    if (oldest == NULL) return false;
+    writePage(oldest);
+  }
+}
+
+Page* freeSlot(PageCache* cache) {
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    Page* page = &cache->slots[i];
+    if (page->count == 0 && page->pendingLength == 0) return page;
+  }
+  return NULL;
+}
+
+Page* oldestSlot(PageCache* cache) {
+  /* the least recently claimed page not taking the current record */
+  Page* oldest = NULL;
+  for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+    Page* page = &cache->slots[i];
+    if (page->pendingLength != 0 || page->count == 0) continue;
+    if (oldest == NULL 
+        || (uint16_t) (cache->clock - cache->used[i]) 
+            > (uint16_t) (cache->clock - cache->used[oldest - cache->slots])) {
+      oldest = page;
+    }
+  }
+  return oldest;
+}
+
+void flushCache(PageCache* cache) {
+  /* lowest address first, so resumeAddress ends up past everything written */
+  while (true) {
+    Page* next = NULL;
+    for (uint8_t i = 0; i < PAGE_SLOTS; i++) {
+      Page* page = &cache->slots[i];
+      if (page->count == 0) continue;
+      if (next == NULL || page->address < next->address) next = page;
+    }
+    if (next == NULL) break;
+    writePage(next);
   }
 }
 
 void writePage(Page* page) {
-  for (uint16_t i = 0; i < page->count; i++) {
-    uint8_t offset = page->offsets[i];
-    uint16_t address = (page->address<<PAGE_BITS) | offset;
+  if (page->count == 0) return;
+  /* read back while the data is still at hand; one rewrite covers a
+   * write cycle cut short, a second mismatch is a bad cell */
+  uint16_t base = page->address<<PAGE_BITS;
+  uint8_t last = loadPage(page);
+  long failed = verifyPage(page);
+  if (failed != -1) {
+    loadPage(page);
+    failed = verifyPage(page);
+  }
+  if (failed != -1 && failedAddress == -1) {
+    /* a resumed burn has to start over from the bad page */
+    failedAddress = failed;
+    resumeAddress = base;
+  }
+  if (failedAddress == -1) {
+    resumeAddress = (unsigned long) base + last + 1;
+    verified += page->count;
+  }
+  memset(page->present, 0, sizeof(page->present));
+  page->count = 0;
+}
+
+uint8_t loadPage(Page* page) {
+  unprotectChip();
+  uint16_t base = page->address<<PAGE_BITS;
+  uint16_t devicePage = base>>device->pageBits;
+  uint8_t last = 0;
+  for (uint8_t offset = 0; offset < PAGE_SIZE; offset++) {
+    if (!isPresent(page, offset)) continue;
+    uint16_t address = base | offset;
+    if ((address>>device->pageBits) != devicePage) {
+      waitMicros(device->byteLoadCycle + (unsigned long) device->writeCycle);
+      devicePage = address>>device->pageBits;
+    }
     writeByte(page->data[offset], address);
+    last = offset;
+  }
+  waitMicros(device->byteLoadCycle + (unsigned long) device->writeCycle);
+  return last;
+}
+
+long verifyPage(Page* page) {
+  uint16_t base = page->address<<PAGE_BITS;
+  long failed = -1;
+  digitalWrite(DATA_OUT_ENABLE, HIGH);
+  digitalWrite(EEPROM_OUT_ENABLE, LOW);
+  for (uint8_t offset = 0; offset < PAGE_SIZE && failed == -1; offset++) {
+    if (isPresent(page, offset) && recvByte(base | offset) != page->data[offset]) {
+      failed = base | offset;
+    }
+  }
+  digitalWrite(EEPROM_OUT_ENABLE, HIGH);
+  digitalWrite(DATA_OUT_ENABLE, LOW);
+  return failed;
+}
+
+void eraseChip() {
+  static const uint8_t data[] = { 0xAA, 0x55, 0x80, 0xAA, 0x55, 0x10 };
+  static const uint16_t addr[] = { 0x5555, 0x2AAA, 0x5555, 0x5555, 0x2AAA, 0x5555 };
+  for (uint8_t i = 0; i < sizeof(data); i++) {
+    writeByte(data[i], addr[i]);
+  }
+  delay(CHIP_ERASE_TIME);
+}
+
+void unprotectChip() {
+  /* a part left protected ignores plain writes and fails every verify;
+   * disabling SDP when it is already off does no harm */
+  static const uint8_t data[] = { 0xAA, 0x55, 0x80, 0xAA, 0x55, 0x20 };
+  static const uint16_t addr[] = { 0x5555, 0x2AAA, 0x5555, 0x5555, 0x2AAA, 0x5555 };
+  if (!device->sdp || unprotected) return;
+  for (uint8_t i = 0; i < sizeof(data); i++) {
+    writeByte(data[i], addr[i]);
+  }
+  waitMicros(device->writeCycle);
+  unprotected = true;
+}
+
+long fillRange(unsigned long start, unsigned long end, 
+    const uint8_t* pattern, uint8_t length) {
+  unsigned long keepalive = millis();
+  unsigned long address = start;
+  while (address < end) {
+    unsigned long pageEnd = ((address >> device->pageBits) + 1) << device->pageBits;
+    if (pageEnd > end) pageEnd = end;
+    long failed = fillPage(address, pageEnd, pattern, length);
+    if (failed != -1) failed = fillPage(address, pageEnd, pattern, length);
+    if (failed != -1) return failed;
+    address = pageEnd;
+
+    if (millis() - keepalive >= KEEPALIVE) {
+      Serial.println(MSG_INFO);
+      keepalive = millis();
+    }
+  }
+  return -1;
+}
+
+long fillPage(unsigned long start, unsigned long end, 
+    const uint8_t* pattern, uint8_t length) {
+  /* load a whole device page, then pay one write cycle for it */
+  unprotectChip();
+  for (unsigned long address = start; address < end; address++) {
+    writeByte(pattern[address % length], address);
+  }
+  waitMicros(device->byteLoadCycle + (unsigned long) device->writeCycle);
+
+  long failed = -1;
+  digitalWrite(DATA_OUT_ENABLE, HIGH);
+  digitalWrite(EEPROM_OUT_ENABLE, LOW);
+  for (unsigned long address = start; address < end && failed == -1; address++) {
+    if (recvByte(address) != pattern[address % length]) failed = address;
+  }
+  digitalWrite(EEPROM_OUT_ENABLE, HIGH);
+  digitalWrite(DATA_OUT_ENABLE, LOW);
+  return failed;
+}
+
+uint16_t crcRange(unsigned long start, unsigned long end) {
+  /* CRC-16/CCITT; one pass over the chip vouches for a cached copy */
+  unsigned long keepalive = millis();
+  uint16_t crc = 0xFFFF;
+  digitalWrite(DATA_OUT_ENABLE, HIGH);
+  digitalWrite(EEPROM_OUT_ENABLE, LOW);
+  for (unsigned long address = start; address < end; address++) {
+    crc ^= (uint16_t) recvByte(address) << 8;
+    for (uint8_t bit = 0; bit < 8; bit++) {
+      crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+
+    if (millis() - keepalive >= KEEPALIVE) {
+      Serial.println(MSG_INFO);
+      keepalive = millis();
+    }
+  }
+  digitalWrite(EEPROM_OUT_ENABLE, HIGH);
+  digitalWrite(DATA_OUT_ENABLE, LOW);
+  return crc;
+}
+
+void readRange(unsigned long start, unsigned long end, char* hex) {
+  digitalWrite(DATA_OUT_ENABLE, HIGH);
+  digitalWrite(EEPROM_OUT_ENABLE, LOW);
+  for (unsigned long address = start; address < end; address++) {
+    snprintf(hex, 3, "%02X", recvByte(address));
+    hex += 2;
   }
-  delay(15);
+  digitalWrite(EEPROM_OUT_ENABLE, HIGH);
+  digitalWrite(DATA_OUT_ENABLE, LOW);
+  *hex = '\0';
 }
 
 void writeByte(uint8_t data, uint16_t addr) {
@@ -190,6 +582,11 @@ void writeByte(uint8_t data, uint16_t addr) {
   digitalWrite(EEPROM_WRITE_ENABLE, HIGH);
 }
 
+void waitMicros(unsigned long us) {
+  delay(us / 1000);
+  delayMicroseconds(us % 1000);
+}
+
 void sendByte(uint8_t data, uint16_t addr) {
   SPI.beginTransaction(SPISettings(14000000, MSBFIRST, SPI_MODE0));
   uint8_t addr_low = addr & 0xff;
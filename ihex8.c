@@ -1,37 +1,83 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include "ihex8.h"
 
+#define SEND_TRIES 8
+#define COMMAND_LENGTH 40
+
 typedef enum {
   OK,
   END,
+  COMMAND,
   ERR_START,
   ERR_LENGTH,
   ERR_ADDRESS,
   ERR_TYPE,
   ERR_UNSUPPORTED,
   ERR_DATA,
+  ERR_DECODE,
   ERR_CHECKSUM,
   ERR_MISMATCH,
-  ERR_END
+  ERR_END,
+  ERR_STORE,
+  ERR_VERIFY,
+  ERR_TIMEOUT
 } ReadStatus;
 
-static ReadStatus readRecord(IHex8* ih, IHex8Record** rec);
+static int lastChar;
+static long lineNumber;         /* of lastChar, while loading */
+
+static ReadStatus readRecord(IHex8* ih, IHex8Record** rec, 
+    IHex8Handler* handler, int* address);
+static ReadStatus readData(IHex8* ih, uint8_t* data, IHex8Handler* handler,
+    uint16_t address, uint8_t length, int* sum);
+static ReadStatus readCompressed(IHex8* ih, uint8_t* data, IHex8Handler* handler,
+    uint16_t address, uint8_t size, uint8_t length, int* sum);
+static void releaseRecord(IHex8Record* rec, IHex8Record* buffer);
+static int reportFault(IHex8* ih, IHex8Handler* handler, uint8_t final);
+static int compressBlock(const uint8_t* in, int n, uint8_t* out);
 static int readByte(IHex8* ih);
 static int readNibble(IHex8* ih);
+static int readChar(IHex8* ih);
+static int readLine(IHex8* ih, char* buf, int buflen);
+static int readResponse(IHex8* ih, char* buf, int buflen);
+
+static void runCommand(IHex8* ih, IHex8Handler* handler);
+static int sendRecord(IHex8* ih, IHex8Record* rec, IHex8Monitor* monitor);
+static void growWindow(IHex8Window* window);
+static void shrinkWindow(IHex8Window* window);
+static int isResponse(const char* buf, const char* msg);
+static int namedAddress(const char* buf);
 
 static void writeRecord(IHex8* ih, IHex8Record* rec);
+static uint16_t recordChars(IHex8Record* rec);
 static void writeByte(IHex8* ih, uint8_t b);
 static void writeNibble(IHex8* ih, uint8_t b);
 
 static int findStartOfRecord(IHex8* ih);
 static int isEndOfRecord(IHex8* ih);
 
-static const char* getResponse(ReadStatus status);
+static const char* getAck(const char* msg, int address, const char* text);
 static const char* getError(ReadStatus status);
 
+typedef struct {
+  IHex8Image* image;
+  long overlaps;
+  int first;
+  int failed;
+  IHex8* ih;
+} LoadContext;
+
+static void storeInImage(IHex8Record* rec, void* ctx);
+static void storeInList(IHex8Record* rec, void* ctx);
+static IHex8Page* allocPage(IHex8Image* image, uint16_t pageAddress);
+static IHex8Record* allocRecord(uint16_t address, uint8_t length);
+static void report(IHex8* ih, int kind, const char* format, ...);
+
 IHex8Record* ihex8Load(IHex8* ih) {
   IHex8Record* head;
   IHex8Record* tail;
@@ -43,9 +89,11 @@ IHex8Record* ihex8Load(IHex8* ih) {
   head->data = NULL;
 
   ReadStatus status = OK;
+  lastChar = 0;
+  lineNumber = 1;
   while (status == OK) {
     IHex8Record* record = NULL;
-    status = readRecord(ih, &record);
+    status = readRecord(ih, &record, NULL, NULL);
     if (status == ERR_START) continue;
     if (status == OK) {
       tail->next = record;
@@ -60,9 +108,7 @@ IHex8Record* ihex8Load(IHex8* ih) {
   else {
     ihex8Free(head);
     tail = NULL;
-    fputs("error: ", stderr);
-    fputs(getError(status), stderr);
-    fputc('\n', stderr);
+    report(ih, IHEX8_REPORT_ERROR, "error: line %ld: %s", lineNumber, getError(status));
   }
   
   return tail;
@@ -70,9 +116,11 @@ IHex8Record* ihex8Load(IHex8* ih) {
 
 int ihex8LoadAndStore(IHex8* ih, void* ctx, void(*store)(IHex8Record*, void*)) {
   ReadStatus status = OK;
+  lastChar = 0;
+  lineNumber = 1;
   while (status == OK) {
     IHex8Record* record = NULL;
-    status = readRecord(ih, &record);
+    status = readRecord(ih, &record, NULL, NULL);
     if (status == ERR_START) continue;
     if (status == OK) {
       store(record, ctx);
@@ -81,70 +129,174 @@ int ihex8LoadAndStore(IHex8* ih, void* ctx, void(*store)(IHex8Record*, void*)) {
   }
 
   if (status != END) {
-    fputs("error: ", stderr);
-    fputs(getError(status), stderr);
-    fputc('\n', stderr);
+    report(ih, IHEX8_REPORT_ERROR, "error: line %ld: %s", lineNumber, getError(status));
   }
   
   return status != END;   
 }
 
 IHex8Record* ihex8Receive(IHex8* ih) {
-  IHex8Record* head;
-  IHex8Record* tail;
+  IHex8Record head;
+  IHex8Record* tail = &head;
+  head.next = NULL;
 
-  head = (IHex8Record*) malloc(sizeof(IHex8Record));
-  tail = head;
-  head->next = NULL;
-  head->address = 0;
-  head->data = NULL;
+  IHex8Handler handler = { storeInList, NULL, &tail };
+  if (!ihex8ReceiveWith(ih, &handler)) {
+    ihex8Free(head.next);
+    return NULL;
+  }
+  return head.next;
+}
+
+static void storeInList(IHex8Record* rec, void* ctx) {
+  IHex8Record** tail = (IHex8Record**) ctx;
+  IHex8Record* record = allocRecord(rec->address, rec->length);
+  if (record == NULL) return;
+  memcpy(record->data, rec->data, rec->length);
+  (*tail)->next = record;
+  *tail = record;
+}
+
+int ihex8ReceiveAndStore(IHex8* ih, void* ctx, void (*store)(IHex8Record*, void*)) {
+  IHex8Handler handler = { store, NULL, ctx };
+  return ihex8ReceiveWith(ih, &handler);
+}
 
+int ihex8ReceiveWith(IHex8* ih, IHex8Handler* handler) {
   ReadStatus status = OK;
-  while (status == OK) {
+  while (status != END && status != ERR_TIMEOUT && status != ERR_VERIFY) {
     IHex8Record* record = NULL;
-    status = readRecord(ih, &record);
-    if (status == ERR_START) continue;
-    ih->writeln(ih->ctx, getResponse(status));
-    if (status == OK) {
-      tail->next = record;
-      tail = record;
+    int address;
+    status = readRecord(ih, &record, handler, &address);
+    if (status != OK && lastChar == -1) {
+      status = ERR_TIMEOUT;
     }
+    if (status != OK && handler->claim != NULL) {
+      handler->discard(handler->ctx);
+    }
+
+    switch (status) {
+      case OK:
+        if (handler->claim != NULL) {
+          handler->commit(handler->ctx);
+        }
+        else {
+          handler->store(record, handler->ctx);
+        }
+        if (reportFault(ih, handler, 0)) {
+          status = ERR_VERIFY;
+          break;
+        }
+        ih->writeln(ih->ctx, getAck(MSG_OK, address, NULL));
+        break;
+      case END:
+        if (reportFault(ih, handler, 1)) {
+          status = ERR_VERIFY;
+          break;
+        }
+        ih->writeln(ih->ctx, MSG_END);
+        break;
+      case COMMAND:
+        runCommand(ih, handler);
+        if (lastChar == -1) status = ERR_TIMEOUT;
+        break;
+      case ERR_TIMEOUT:
+        break;
+      default:
+        if (lastChar != '\n') {
+          while (readChar(ih) != '\n' && lastChar != -1) continue;
+        }
+        ih->writeln(ih->ctx, getAck(MSG_NAK, address, getError(status)));
+        if (lastChar == -1) status = ERR_TIMEOUT;
+        break;
+    }
+    releaseRecord(record, handler->record);
   }
 
-  if (status == END) {
-    tail = head->next;
-    free(head); 
+  return status == END;
+}
+
+static int reportFault(IHex8* ih, IHex8Handler* handler, uint8_t final) {
+  /* written data is only known bad after it has been acked, so the
+   * next ack turns into an error that ends the transfer */
+  if (handler->verify == NULL) return 0;
+  const char* fault = handler->verify(final, handler->ctx);
+  if (fault == NULL) return 0;
+
+  char message[2*COMMAND_LENGTH];
+  snprintf(message, sizeof(message), "%s: %s", MSG_ERROR, fault);
+  ih->writeln(ih->ctx, message);
+  return 1;
+}
+
+static void runCommand(IHex8* ih, IHex8Handler* handler) {
+  char line[COMMAND_LENGTH];
+  char reply[COMMAND_LENGTH];
+  char message[2*COMMAND_LENGTH];
+
+  if (readLine(ih, line, sizeof(line)) < 0) return;
+
+  int rc = -1;
+  reply[0] = '\0';
+  if (handler->command != NULL) {
+    rc = handler->command(line, reply, sizeof(reply), handler->ctx);
   }
   else {
-    ihex8Free(head);
-    tail = NULL;
+    strncpy(reply, "unsupported command", sizeof(reply));
   }
-  return tail;
+
+  if (rc == 0) {
+    char* verb = strtok(line, " ");
+    snprintf(message, sizeof(message), "%s %s%s%s", MSG_OK, 
+        verb != NULL ? verb : "", reply[0] ? " " : "", reply);
+  }
+  else {
+    snprintf(message, sizeof(message), "%s: %s", MSG_ERROR, reply);
+  }
+  ih->writeln(ih->ctx, message);
 }
 
-int ihex8ReceiveAndStore(IHex8* ih, void* ctx, void (*store)(IHex8Record*, void*)) {
-  
-  ReadStatus status = OK;
-  while (status == OK) {
-    IHex8Record* record = NULL;
-    status = readRecord(ih, &record);
-    if (status == ERR_START) continue;
-    ih->writeln(ih->ctx, getResponse(status));
-    if (status == OK) {
-      store(record, ctx);
+int ihex8Command(IHex8* ih, const char* cmd, char* reply, int replylen) {
+  char buf[256];
+  int verblen = strcspn(cmd, " ");
+
+  for (int tries = 0; tries < SEND_TRIES; tries++) {
+    ih->writec(ih->ctx, CMD_START);
+    ih->writeln(ih->ctx, cmd);
+
+    int n;
+    while ((n = readResponse(ih, buf, sizeof(buf))) > 0) {
+      if (isResponse(buf, MSG_OK) && buf[strlen(MSG_OK)] == ' '
+          && strncmp(buf + strlen(MSG_OK) + 1, cmd, verblen) == 0) {
+        const char* p = buf + strlen(MSG_OK) + 1 + verblen;
+        if (*p != ' ' && *p != '\0') continue;
+        if (*p == ' ') p++;
+        if (reply != NULL) {
+          strncpy(reply, p, replylen);
+          reply[replylen - 1] = '\0';
+        }
+        return 0;
+      }
+      if (isResponse(buf, MSG_ERROR)) {
+        report(ih, IHEX8_REPORT_ERROR, "%s", buf);
+        return -1;
+      }
     }
-    ihex8Free(record);
+    if (n < 0) return -1;
   }
 
-  return status == END;
+  report(ih, IHEX8_REPORT_ERROR, "no response to command %s", cmd);
+  return -1;
 }
 
-static ReadStatus readRecord(IHex8* ih, IHex8Record** rec) {
+static ReadStatus readRecord(IHex8* ih, IHex8Record** rec, 
+    IHex8Handler* handler, int* address) {
   *rec = NULL;
+  if (address != NULL) *address = -1;
  
-  if (!findStartOfRecord(ih)) {
-    return ERR_START;
-  }
+  int c = findStartOfRecord(ih);
+  if (c == CMD_START) return COMMAND;
+  if (c != ':') return ERR_START;
   
   int length = readByte(ih);
   if (length == -1) return ERR_LENGTH;
@@ -154,49 +306,69 @@ static ReadStatus readRecord(IHex8* ih, IHex8Record** rec) {
   
   int lsb = readByte(ih);
   if (lsb == -1) return ERR_ADDRESS;
+  if (address != NULL) *address = (msb<<8) | lsb;
   
   int type = readByte(ih);
   if (type == -1) return ERR_TYPE;
   
-  if (type != 0 && type != 1) return ERR_UNSUPPORTED;
-  
-  if (type == 0 && length > 0) {
-    IHex8Record* record = (IHex8Record*) malloc(sizeof(IHex8Record));
-    record->address = (msb<<8) | lsb;
-    record->length = length;
-    record->data = (uint8_t*) malloc(length*sizeof(uint8_t));
-    record->next = NULL;
-  
-    int sum = length;
-    sum += msb;
-    sum += lsb;
+  if (type != IHEX8_DATA && type != IHEX8_EOF && type != IHEX8_LZ) {
+    return ERR_UNSUPPORTED;
+  }
+
+  int sum = length;
+  sum += msb;
+  sum += lsb;
+  sum += type;
+
+  /* an LZ record leads with the length it decodes to */
+  uint8_t size = length;
+  if (type == IHEX8_LZ) {
+    int decoded = length > 0 ? readByte(ih) : -1;
+    if (decoded <= 0) return ERR_DECODE;
+    sum += decoded;
+    size = decoded;
+    length--;
+  }
   
-    for (int i = 0; i < length; i++) {
-      int b = readByte(ih);
-      if (b == -1) {
-        ihex8Free(record);
-        return ERR_DATA;
+  IHex8Record* buffer = handler != NULL ? handler->record : NULL;
+  if (type != IHEX8_EOF && size > 0) {
+    IHex8Record* record = NULL;
+    uint8_t* data = NULL;
+    if (handler == NULL || handler->claim == NULL) {
+      record = buffer;
+      if (record == NULL) {
+        record = allocRecord((msb<<8) | lsb, size);
+        if (record == NULL) return ERR_STORE;
       }
-      record->data[i] = (uint8_t) b;
-      sum += b;
+      record->address = (msb<<8) | lsb;
+      record->length = size;
+      record->type = IHEX8_DATA;
+      record->next = NULL;
+      data = record->data;
     }
   
-    int checksum = readByte(ih);
-    if (checksum == -1) {
-      ihex8Free(record);
-      return ERR_CHECKSUM;
+    ReadStatus status = type == IHEX8_LZ
+        ? readCompressed(ih, data, handler, (msb<<8) | lsb, size, length, &sum)
+        : readData(ih, data, handler, (msb<<8) | lsb, length, &sum);
+    if (status == OK) {
+      int checksum = readByte(ih);
+      if (checksum == -1) {
+        status = ERR_CHECKSUM;
+      }
+      else if (((sum + checksum) & 0xff) != 0) {
+        status = ERR_MISMATCH;
+      }
     }
-  
-    sum += checksum;
-    if ((sum & 0xff) != 0) {
-      ihex8Free(record);
-      return ERR_MISMATCH;
+
+    if (status != OK) {
+      releaseRecord(record, buffer);
+      return status;
     }
 
     *rec = record;
   }
   
-  if (type == 1) {
+  if (type == IHEX8_EOF) {
     int checksum = readByte(ih);
     if (checksum != 0xff) {
       return ERR_MISMATCH;
@@ -205,29 +377,97 @@ static ReadStatus readRecord(IHex8* ih, IHex8Record** rec) {
 
   if (!isEndOfRecord(ih)) {
     if (*rec != NULL) {
-      ihex8Free(*rec);
+      releaseRecord(*rec, buffer);
+      *rec = NULL;
     }
     return ERR_END;
   }
 
-  return type == 0 ? OK : END;
+  return type == IHEX8_EOF ? END : OK;
+}
+
+static ReadStatus readData(IHex8* ih, uint8_t* data, IHex8Handler* handler,
+    uint16_t address, uint8_t length, int* sum) {
+  uint8_t i = 0;
+  while (i < length) {
+    uint8_t n = length - i;
+    uint8_t* p = data != NULL ? data + i : handler->claim(address + i, &n, handler->ctx);
+    if (p == NULL || n == 0) return ERR_STORE;
+
+    for (uint8_t j = 0; j < n; j++) {
+      int b = readByte(ih);
+      if (b == -1) return ERR_DATA;
+      p[j] = (uint8_t) b;
+      *sum += b;
+    }
+    i += n;
+  }
+  return OK;
+}
+
+static ReadStatus readCompressed(IHex8* ih, uint8_t* data, IHex8Handler* handler,
+    uint16_t address, uint8_t size, uint8_t length, int* sum) {
+  /* matches copy from earlier output, so the block must land in one piece */
+  uint8_t n = size;
+  uint8_t* p = data != NULL ? data : handler->claim(address, &n, handler->ctx);
+  if (p == NULL || n < size) return ERR_STORE;
+
+  int out = 0;
+  int in = 0;
+  while (in < length) {
+    int token = readByte(ih);
+    if (token == -1) return ERR_DATA;
+    *sum += token;
+    in++;
+
+    if (token < 0x80) {
+      int count = token + 1;
+      if (out + count > size || in + count > length) return ERR_DECODE;
+      for (int i = 0; i < count; i++) {
+        int b = readByte(ih);
+        if (b == -1) return ERR_DATA;
+        *sum += b;
+        p[out++] = (uint8_t) b;
+      }
+      in += count;
+    }
+    else {
+      int count = (token & 0x7f) + 3;
+      int distance = readByte(ih);
+      if (distance == -1) return ERR_DATA;
+      *sum += distance;
+      in++;
+      distance++;
+      if (distance > out || out + count > size || in > length) return ERR_DECODE;
+      for (int i = 0; i < count; i++, out++) {
+        p[out] = p[out - distance];
+      }
+    }
+  }
+  return out == size ? OK : ERR_DECODE;
+}
+
+static void releaseRecord(IHex8Record* rec, IHex8Record* buffer) {
+  if (rec != buffer) {
+    ihex8Free(rec);
+  }
 }
 
 static int findStartOfRecord(IHex8* ih) {
-  int c = ih->readc(ih->ctx);
+  int c = readChar(ih);
   while (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
     if (c == '\r' || c == '\n') {
       ih->writeln(ih->ctx, MSG_OK);
     }
-    c = ih->readc(ih->ctx);
+    c = readChar(ih);
   }
-  return c == ':';
+  return c;
 }
 
 static int isEndOfRecord(IHex8* ih) {
-  int c = ih->readc(ih->ctx);
+  int c = readChar(ih);
   if (c == '\r') {
-    c = ih->readc(ih->ctx);
+    c = readChar(ih);
   }
   return c == '\n';
 }
@@ -241,7 +481,7 @@ static int readByte(IHex8* ih) {
 }
 
 static int readNibble(IHex8* ih) {
-  int c = ih->readc(ih->ctx);
+  int c = readChar(ih);
   if (c == -1) return -1;
   if (c >= '0' && c <= '9') {
     return c - '0';
@@ -255,6 +495,58 @@ static int readNibble(IHex8* ih) {
   return -1;
 }
 
+static int readChar(IHex8* ih) {
+  if (lastChar == '\n') lineNumber++;
+  lastChar = ih->readc(ih->ctx);
+  return lastChar;
+}
+
+static int readLine(IHex8* ih, char* buf, int buflen) {
+  int n = 0;
+  int c = readChar(ih);
+  while (c != '\n') {
+    if (c == -1) return -1;
+    if (c != '\r' && n < buflen - 1) {
+      buf[n++] = c;
+    }
+    c = readChar(ih);
+  }
+  buf[n] = '\0';
+  return n;
+}
+
+static int readResponse(IHex8* ih, char* buf, int buflen) {
+  while (1) {
+    int n = ih->readln(ih->ctx, buf, buflen);
+    if (n <= 0) return n;
+    if (isResponse(buf, MSG_INFO)) {
+      /* a bare INFO is a keepalive from a long-running command */
+      if (buf[strlen(MSG_INFO)] != '\0') {
+        report(ih, IHEX8_REPORT_INFO, "%s", buf + strlen(MSG_INFO) + 1);
+      }
+      continue;
+    }
+    return n;
+  }
+}
+
+static int isResponse(const char* buf, const char* msg) {
+  int n = strlen(msg);
+  return strncmp(buf, msg, n) == 0 
+      && (buf[n] == '\0' || buf[n] == ' ' || buf[n] == ':');
+}
+
+static int namedAddress(const char* buf) {
+  const char* p = strchr(buf, ' ');
+  if (p == NULL) return -1;
+  p++;
+  for (int i = 0; i < 4; i++) {
+    if (!isxdigit((unsigned char) p[i])) return -1;
+  }
+  if (p[4] != ' ' && p[4] != '\0') return -1;
+  return (int) strtol(p, NULL, 16);
+}
+
 void ihex8Dump(IHex8Record* top, IHex8* ih) {
   while (top != NULL) {
     writeRecord(ih, top);
@@ -265,41 +557,165 @@ void ihex8Dump(IHex8Record* top, IHex8* ih) {
 }
 
 int ihex8Send(IHex8Record* top, IHex8* ih) {
-  char buf[256];
-  int n;
-  
+  return ihex8SendWith(top, ih, NULL);
+}
+
+int ihex8SendWith(IHex8Record* top, IHex8* ih, IHex8Monitor* monitor) {
   while (top != NULL) {
-    writeRecord(ih, top);
-    while (1) {
-      n = ih->readln(ih->ctx, buf, sizeof(buf));
-      if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
-        fprintf(stdout, "%s\n", buf+strlen(MSG_INFO) + 1);
-        continue;
-      }
-      break;
+    if (sendRecord(ih, top, monitor) != 0) return -1;
+    top = top->next;
+  }
+  return sendRecord(ih, NULL, monitor);
+}
+
+int ihex8SendWindow(IHex8Record* top, IHex8Record* end, IHex8* ih, 
+    IHex8Monitor* monitor, IHex8Window* window) {
+  IHex8Record* flight[IHEX8_WINDOW_MAX];
+  uint8_t tries[IHEX8_WINDOW_MAX];
+  int count = 0;
+  char buf[256];
+
+  if (window->limit < 1) window->limit = 1;
+  if (window->limit > IHEX8_WINDOW_MAX) window->limit = IHEX8_WINDOW_MAX;
+  if (window->size < 1) window->size = 1;
+  if (window->size > window->limit) window->size = window->limit;
+  if (window->buffer == 0) window->buffer = IHEX8_RX_BUFFER;
+
+  while (top != end || count > 0) {
+    /* while the controller writes the oldest record, everything sent
+     * after it waits in its receive buffer and must fit there */
+    uint16_t queued = 0;
+    for (int i = 1; i < count; i++) {
+      queued += recordChars(flight[i]);
+    }
+    while (top != end && count < window->size
+        && (count == 0 || queued + recordChars(top) <= window->buffer)) {
+      if (count > 0) queued += recordChars(top);
+      writeRecord(ih, top);
+      if (monitor != NULL) monitor->sent(top, monitor->ctx);
+      flight[count] = top;
+      tries[count++] = 0;
+      top = top->next;
     }
-    if (strncmp(buf, MSG_OK, strlen(buf)) != 0) {
-      fprintf(stderr, "unexpected response: %s\n", buf);
+    if (count > window->peak) window->peak = count;
+
+    int n = readResponse(ih, buf, sizeof(buf));
+    if (n < 0) return -1;
+    if (n > 0 && isResponse(buf, MSG_ERROR)) {
+      report(ih, IHEX8_REPORT_ERROR, "unexpected response: %s", buf);
       return -1;
     }
-    top = top->next;
-  }
-  
-  ih->writeln(ih->ctx, ":00000001FF");
-  while (1) {
-    n = ih->readln(ih->ctx, buf, sizeof(buf));
-    if (strncmp(buf, MSG_INFO, strlen(MSG_INFO)) == 0) {
-      fprintf(stdout, "%s\n", buf+strlen(MSG_INFO) + 1);
+
+    int named = n > 0 ? namedAddress(buf) : -1;
+    int i = 0;
+    while (i < count && flight[i]->address != named) i++;
+    if (n > 0 && isResponse(buf, MSG_OK)) {
+      /* a bare OK answers a stray line end, such as the one sent after
+       * a timeout, and one for a record no longer in flight a duplicate;
+       * only an ack naming a record in flight counts */
+      if (i == count) continue;
+      if (monitor != NULL) monitor->acked(flight[i], monitor->ctx);
+      count--;
+      memmove(&flight[i], &flight[i + 1], (count - i) * sizeof(flight[0]));
+      memmove(&tries[i], &tries[i + 1], count - i);
+      growWindow(window);
       continue;
     }
-    break;
+    if (n > 0 && !isResponse(buf, MSG_NAK)) continue;
+
+    /* a NAK means the controller is dropping bytes, a timeout that
+     * everything in flight may be lost; either way send fewer at once */
+    shrinkWindow(window);
+    int first = 0;
+    if (n == 0) {
+      ih->writec(ih->ctx, '\n');
+    }
+    else {
+      report(ih, IHEX8_REPORT_ERROR, "%s", buf);
+      /* a NAK naming no record in flight had its address garbled; as
+       * responses come in send order, it is most likely the oldest */
+      if (i == count) i = 0;
+      /* resent, it moves to the back to keep acks in flight order */
+      IHex8Record* rec = flight[i];
+      uint8_t tried = tries[i];
+      memmove(&flight[i], &flight[i + 1], (count - i - 1) * sizeof(flight[0]));
+      memmove(&tries[i], &tries[i + 1], count - i - 1);
+      flight[count - 1] = rec;
+      tries[count - 1] = tried;
+      first = count - 1;
+    }
+    for (i = first; i < count; i++) {
+      if (monitor != NULL) monitor->nacked(flight[i], monitor->ctx);
+      if (++tries[i] >= SEND_TRIES) {
+        report(ih, IHEX8_REPORT_ERROR, "no acknowledgement for record at %04X", 
+            flight[i]->address);
+        return -1;
+      }
+      writeRecord(ih, flight[i]);
+      if (monitor != NULL) monitor->sent(flight[i], monitor->ctx);
+    }
   }
-  if (strncmp(buf, MSG_END, strlen(buf)) != 0) {
-    fprintf(stderr , "unexpected response: %s\n", buf);
-    return -1;
+  return 0;
+}
+
+static void growWindow(IHex8Window* window) {
+  /* one more in flight after a full window of clean acks */
+  if (++window->streak < window->size) return;
+  window->streak = 0;
+  if (window->size < window->limit) window->size++;
+}
+
+static void shrinkWindow(IHex8Window* window) {
+  window->streak = 0;
+  window->backoffs++;
+  if (window->size > 1) window->size /= 2;
+}
+
+static int sendRecord(IHex8* ih, IHex8Record* rec, IHex8Monitor* monitor) {
+  char buf[256];
+  int address = rec != NULL ? rec->address : -1;
+  
+  for (int tries = 0; tries < SEND_TRIES; tries++) {
+    if (rec != NULL) {
+      writeRecord(ih, rec);
+    }
+    else {
+      ih->writeln(ih->ctx, ":00000001FF");
+    }
+    if (monitor != NULL) monitor->sent(rec, monitor->ctx);
+
+    int n;
+    while ((n = readResponse(ih, buf, sizeof(buf))) > 0) {
+      if ((rec == NULL && isResponse(buf, MSG_END)) 
+          || (rec != NULL && isResponse(buf, MSG_OK) 
+              && namedAddress(buf) == address)) {
+        if (monitor != NULL) monitor->acked(rec, monitor->ctx);
+        return 0;
+      }
+      if (isResponse(buf, MSG_NAK)) {
+        int named = namedAddress(buf);
+        if (rec == NULL || named == -1 || named == address) break;
+        continue;
+      }
+      if (isResponse(buf, MSG_ERROR)) {
+        report(ih, IHEX8_REPORT_ERROR, "unexpected response: %s", buf);
+        return -1;
+      }
+    }
+    if (n < 0) return -1;
+    if (monitor != NULL) monitor->nacked(rec, monitor->ctx);
+    if (n == 0) {
+      /* terminate any partial record so that the controller resyncs */
+      ih->writec(ih->ctx, '\n');
+    }
+    else {
+      report(ih, IHEX8_REPORT_ERROR, "%s", buf);
+    }
   }
 
-  return 0;
+  report(ih, IHEX8_REPORT_ERROR, "no acknowledgement for record at %04X", 
+      rec != NULL ? rec->address : 0);
+  return -1;
 }
 
 static void writeRecord(IHex8* ih, IHex8Record* rec) {
@@ -316,7 +732,8 @@ static void writeRecord(IHex8* ih, IHex8Record* rec) {
   sum += lsb;
   writeByte(ih, lsb);
 
-  writeByte(ih, 0);
+  sum += rec->type;
+  writeByte(ih, rec->type);
   for (int i = 0; i < rec->length; i++) {
     uint8_t b = rec->data[i];
     sum += b;
@@ -327,6 +744,11 @@ static void writeRecord(IHex8* ih, IHex8Record* rec) {
   ih->writec(ih->ctx, '\n');  
 }
 
+static uint16_t recordChars(IHex8Record* rec) {
+  /* colon, length, address, type, data, checksum and newline */
+  return 12 + 2 * rec->length;
+}
+
 static void writeByte(IHex8* ih, uint8_t b) {
   writeNibble(ih, b >> 4);
   writeNibble(ih, b & 0xf);
@@ -341,6 +763,67 @@ static void writeNibble(IHex8* ih, uint8_t c) {
   }
 }
 
+long ihex8Compress(IHex8Record* top) {
+  uint8_t out[1 + IHEX8_LZ_BLOCK + IHEX8_LZ_BLOCK / 128 + 1];
+  long saved = 0;
+  for (; top != NULL; top = top->next) {
+    if (top->type != IHEX8_DATA || top->length == 0) continue;
+    uint16_t last = top->address + top->length - 1;
+    if (top->length > IHEX8_LZ_BLOCK
+        || top->address / IHEX8_LZ_BLOCK != last / IHEX8_LZ_BLOCK) {
+      continue;
+    }
+
+    out[0] = top->length;
+    int length = 1 + compressBlock(top->data, top->length, out + 1);
+    if (length >= top->length) continue;
+
+    uint8_t* data = (uint8_t*) malloc(length);
+    if (data == NULL) return -1;
+    memcpy(data, out, length);
+    free(top->data);
+    saved += top->length - length;
+    top->data = data;
+    top->length = length;
+    top->type = IHEX8_LZ;
+  }
+  return saved;
+}
+
+static int compressBlock(const uint8_t* in, int n, uint8_t* out) {
+  int length = 0;
+  int literal = -1;             /* index of the open literal token */
+  int pos = 0;
+  while (pos < n) {
+    int best = 0;
+    int distance = 0;
+    for (int d = 1; d <= pos && d <= 256; d++) {
+      int m = 0;
+      while (pos + m < n && m < 130 && in[pos + m - d] == in[pos + m]) m++;
+      if (m > best) {
+        best = m;
+        distance = d;
+      }
+    }
+
+    if (best >= 3) {
+      out[length++] = 0x80 | (best - 3);
+      out[length++] = distance - 1;
+      literal = -1;
+      pos += best;
+    }
+    else {
+      if (literal == -1 || out[literal] == 0x7f) {
+        literal = length;
+        out[length++] = 0xff;   /* becomes 0 on the first increment */
+      }
+      out[literal]++;
+      out[length++] = in[pos++];
+    }
+  }
+  return length;
+}
+
 void ihex8Free(IHex8Record* top) {
   IHex8Record* temp;
   while (top != NULL) {
@@ -351,19 +834,279 @@ void ihex8Free(IHex8Record* top) {
   }
 }
 
-static const char* getResponse(ReadStatus status) {
-  static char message[256];
-  
-  if (status == OK) {
-    return MSG_OK;
+IHex8Image* ihex8ImageCreate(uint8_t pageBits) {
+  if (pageBits > 15) return NULL;
+
+  IHex8Image* image = (IHex8Image*) malloc(sizeof(IHex8Image));
+  if (image == NULL) return NULL;
+
+  image->pageBits = pageBits;
+  image->pageCount = 1UL << (16 - pageBits);
+  image->pages = (IHex8Page**) calloc(image->pageCount, sizeof(IHex8Page*));
+  if (image->pages == NULL) {
+    free(image);
+    return NULL;
   }
-  else if (status == END) {
-    return MSG_END;
+  return image;
+}
+
+IHex8Image* ihex8LoadImage(IHex8* ih, uint8_t pageBits) {
+  LoadContext load;
+  load.image = ihex8ImageCreate(pageBits);
+  load.overlaps = 0;
+  load.first = -1;
+  load.failed = 0;
+  load.ih = ih;
+  if (load.image == NULL) return NULL;
+
+  if (ihex8LoadAndStore(ih, &load, storeInImage) != 0 || load.failed) {
+    ihex8ImageFree(load.image);
+    return NULL;
+  }
+  if (load.overlaps > 0) {
+    report(ih, IHEX8_REPORT_ERROR, "warning: %ld byte(s) overlap earlier records, first at %04X",
+        load.overlaps, load.first);
+  }
+  return load.image;
+}
+
+static void storeInImage(IHex8Record* rec, void* ctx) {
+  LoadContext* load = (LoadContext*) ctx;
+  long overlaps = ihex8ImageStore(load->image, rec);
+  if (overlaps < 0) {
+    load->failed = 1;
+    report(load->ih, IHEX8_REPORT_ERROR, "error: out of memory");
+  }
+  else if (overlaps > 0) {
+    if (load->first == -1) load->first = rec->address;
+    load->overlaps += overlaps;
+  }
+}
+
+int ihex8ImagePut(IHex8Image* image, uint16_t address, uint8_t data) {
+  uint16_t pageAddress = address >> image->pageBits;
+  uint16_t offset = address & ((1U << image->pageBits) - 1);
+
+  IHex8Page* page = image->pages[pageAddress];
+  if (page == NULL) {
+    page = allocPage(image, pageAddress);
+    if (page == NULL) return -1;
   }
 
-  strncpy(message, MSG_ERROR, sizeof(message));
-  strncpy(message, ": ", sizeof(message) - strlen(message) - 1);
-  strncat(message, getError(status), sizeof(message) - strlen(message) - 1);
+  page->data[offset] = data;
+  if (ihex8PageHas(page, offset)) return 1;
+
+  page->present[offset >> 3] |= 1 << (offset & 7);
+  page->count++;
+  return 0;
+}
+
+int ihex8ImageGet(IHex8Image* image, uint16_t address) {
+  IHex8Page* page = image->pages[address >> image->pageBits];
+  if (page == NULL) return -1;
+
+  uint16_t offset = address & ((1U << image->pageBits) - 1);
+  if (!ihex8PageHas(page, offset)) return -1;
+  return page->data[offset];
+}
+
+long ihex8ImageStore(IHex8Image* image, IHex8Record* rec) {
+  long overlaps = 0;
+  for (uint16_t i = 0; i < rec->length; i++) {
+    int rc = ihex8ImagePut(image, rec->address + i, rec->data[i]);
+    if (rc < 0) return -1;
+    overlaps += rc;
+  }
+  return overlaps;
+}
+
+long ihex8ImageMerge(IHex8Image* dst, IHex8Image* src) {
+  uint16_t size = 1U << src->pageBits;
+  long overlaps = 0;
+  IHex8Page* page = NULL;
+  while ((page = ihex8ImageNext(src, page)) != NULL) {
+    uint16_t base = page->address << src->pageBits;
+    for (uint16_t i = 0; i < size; i++) {
+      if (!ihex8PageHas(page, i)) continue;
+      int rc = ihex8ImagePut(dst, base + i, page->data[i]);
+      if (rc < 0) return -1;
+      overlaps += rc;
+    }
+  }
+  return overlaps;
+}
+
+IHex8Image* ihex8ImageDiff(IHex8Image* from, IHex8Image* to) {
+  IHex8Image* diff = ihex8ImageCreate(to->pageBits);
+  if (diff == NULL) return NULL;
+
+  uint16_t size = 1U << to->pageBits;
+  IHex8Page* page = NULL;
+  while ((page = ihex8ImageNext(to, page)) != NULL) {
+    uint16_t base = page->address << to->pageBits;
+    for (uint16_t i = 0; i < size; i++) {
+      if (!ihex8PageHas(page, i)) continue;
+      if (ihex8ImageGet(from, base + i) == page->data[i]) continue;
+      if (ihex8ImagePut(diff, base + i, page->data[i]) < 0) {
+        ihex8ImageFree(diff);
+        return NULL;
+      }
+    }
+  }
+  return diff;
+}
+
+IHex8Image* ihex8ImageStrip(IHex8Image* image, const uint8_t* pattern,
+    uint8_t patternLength, uint8_t minRun) {
+  IHex8Image* stripped = ihex8ImageCreate(image->pageBits);
+  if (stripped == NULL) return NULL;
+
+  uint16_t size = 1U << image->pageBits;
+  IHex8Page* page = NULL;
+  while ((page = ihex8ImageNext(image, page)) != NULL) {
+    uint16_t base = page->address << image->pageBits;
+    uint16_t offset = 0;
+    while (offset < size) {
+      /* absent bytes already hold the pattern, so they extend a run */
+      uint16_t start = offset;
+      while (offset < size && (!ihex8PageHas(page, offset) 
+          || page->data[offset] == pattern[(base + offset) % patternLength])) {
+        offset++;
+      }
+
+      /* records split at page edges anyway, so a run touching one costs 
+       * nothing to drop; a short interior run is cheaper to send */
+      uint16_t end = offset;
+      if (end - start < minRun && start != 0 && end != size) {
+        end = start;
+      }
+      while (end < size && (end < offset || (ihex8PageHas(page, end)
+          && page->data[end] != pattern[(base + end) % patternLength]))) {
+        if (ihex8PageHas(page, end) 
+            && ihex8ImagePut(stripped, base + end, page->data[end]) < 0) {
+          ihex8ImageFree(stripped);
+          return NULL;
+        }
+        end++;
+      }
+      offset = end;
+    }
+  }
+  return stripped;
+}
+
+IHex8Page* ihex8ImagePage(IHex8Image* image, uint16_t address) {
+  return image->pages[address >> image->pageBits];
+}
+
+IHex8Page* ihex8ImageNext(IHex8Image* image, IHex8Page* page) {
+  uint32_t i = page == NULL ? 0 : (uint32_t) page->address + 1;
+  while (i < image->pageCount) {
+    if (image->pages[i] != NULL && image->pages[i]->count != 0) {
+      return image->pages[i];
+    }
+    i++;
+  }
+  return NULL;
+}
+
+int ihex8PageHas(IHex8Page* page, uint16_t offset) {
+  return (page->present[offset >> 3] >> (offset & 7)) & 1;
+}
+
+IHex8Record* ihex8ImageRecords(IHex8Image* image, uint8_t maxLength) {
+  IHex8Record head;
+  IHex8Record* tail = &head;
+  head.next = NULL;
+
+  if (maxLength == 0) maxLength = 255;
+
+  uint16_t size = 1U << image->pageBits;
+  IHex8Page* page = NULL;
+  while ((page = ihex8ImageNext(image, page)) != NULL) {
+    uint16_t base = page->address << image->pageBits;
+    uint16_t offset = 0;
+    while (offset < size) {
+      if (!ihex8PageHas(page, offset)) {
+        offset++;
+        continue;
+      }
+
+      uint16_t start = offset;
+      while (offset < size && offset - start < maxLength
+          && ihex8PageHas(page, offset)) {
+        offset++;
+      }
+
+      IHex8Record* record = allocRecord(base + start, offset - start);
+      if (record == NULL) {
+        ihex8Free(head.next);
+        return NULL;
+      }
+      memcpy(record->data, page->data + start, record->length);
+      tail->next = record;
+      tail = record;
+    }
+  }
+
+  return head.next;
+}
+
+void ihex8ImageFree(IHex8Image* image) {
+  if (image == NULL) return;
+  for (uint32_t i = 0; i < image->pageCount; i++) {
+    if (image->pages[i] != NULL) free(image->pages[i]);
+  }
+  free(image->pages);
+  free(image);
+}
+
+static IHex8Page* allocPage(IHex8Image* image, uint16_t pageAddress) {
+  uint16_t size = 1U << image->pageBits;
+  uint16_t mapSize = (size + 7) / 8;
+
+  IHex8Page* page = (IHex8Page*) malloc(sizeof(IHex8Page) + size + mapSize);
+  if (page == NULL) return NULL;
+
+  page->address = pageAddress;
+  page->count = 0;
+  page->data = (uint8_t*) (page + 1);
+  page->present = page->data + size;
+  memset(page->data, 0xff, size);
+  memset(page->present, 0, mapSize);
+
+  image->pages[pageAddress] = page;
+  return page;
+}
+
+static IHex8Record* allocRecord(uint16_t address, uint8_t length) {
+  IHex8Record* record = (IHex8Record*) malloc(sizeof(IHex8Record));
+  if (record == NULL) return NULL;
+
+  record->data = (uint8_t*) malloc(length*sizeof(uint8_t));
+  if (record->data == NULL) {
+    free(record);
+    return NULL;
+  }
+  record->address = address;
+  record->length = length;
+  record->type = IHEX8_DATA;
+  record->next = NULL;
+  return record;
+}
+
+static const char* getAck(const char* msg, int address, const char* text) {
+  static char message[64];
+  
+  if (address == -1) {
+    snprintf(message, sizeof(message), "%s %s", msg, text != NULL ? text : "");
+  }
+  else if (text == NULL) {
+    snprintf(message, sizeof(message), "%s %04X", msg, address);
+  }
+  else {
+    snprintf(message, sizeof(message), "%s %04X %s", msg, address, text);
+  }
 
   return message;
 }
@@ -382,13 +1125,31 @@ static const char *getError(ReadStatus status) {
       return "unsupported record type";
     case ERR_DATA:
       return "expected data byte";
+    case ERR_DECODE:
+      return "bad compressed data";
     case ERR_CHECKSUM:
       return "expected checksum";
     case ERR_MISMATCH:
       return "checksum mismatch";
     case ERR_END:
       return "expected end of record";
+    case ERR_STORE:
+      return "cannot store data";
+    case COMMAND:
+      return "unexpected command";
+    case ERR_TIMEOUT:
+      return "timeout";
     default:
       return NULL;
   }
 }
+
+static void report(IHex8* ih, int kind, const char* format, ...) {
+  if (ih->report == NULL) return;
+  char message[300];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  ih->report(ih->ctx, kind, message);
+}
@@ -7,11 +7,33 @@
 #define MSG_INFO  "INFO"
 #define MSG_END   "END"
 #define MSG_ERROR "ERROR"
+#define MSG_NAK   "NAK"
+#define MSG_VERIFIED "VERIFIED"   /* bytes the controller read back after writing */
+
+#define IHEX8_MAX_LENGTH 255
+
+#define IHEX8_DATA 0x00
+#define IHEX8_EOF  0x01
+#define IHEX8_LZ   0x10         /* extension: decoded length, then LZ tokens */
+#define IHEX8_LZ_BLOCK 64       /* an LZ record never crosses a block boundary */
+
+#define CMD_START  '!'
+#define CMD_RESUME "RESUME"
+#define CMD_DEVICE "DEVICE"
+#define CMD_ERASE  "ERASE"
+#define CMD_FILL   "FILL"
+#define CMD_CRC    "CRC"
+#define CMD_READ   "READ"
+#define IHEX8_READ_LENGTH 16    /* bytes in the reply to one READ */
+
+#define IHEX8_REPORT_INFO  0    /* text the controller sent with INFO */
+#define IHEX8_REPORT_ERROR 1    /* what went wrong, or a warning */
 
 typedef struct ihex8_record_t {
   struct ihex8_record_t* next;
   uint16_t address;
   uint8_t length;
+  uint8_t type;
   uint8_t* data;
 } IHex8Record;
 
@@ -22,8 +44,57 @@ typedef struct ihex8_t {
   int (*writec)(void* ctx, char c);
   int (*writeln)(void* ctx, const char* s);
   void* ctx;
+  void (*report)(void* ctx, int kind, const char* s);
+                                /* diagnostics, NULL drops them */
 } IHex8;
 
+typedef struct ihex8_handler_t {
+  void (*store)(IHex8Record* rec, void* ctx);
+  int (*command)(char* line, char* reply, int replylen, void* ctx);
+  void* ctx;
+  IHex8Record* record;          /* optional buffer of IHEX8_MAX_LENGTH bytes */
+  uint8_t* (*claim)(uint16_t address, uint8_t* length, void* ctx);
+                                /* where to decode up to *length data bytes */
+  void (*commit)(void* ctx);    /* claimed data passed its checksum */
+  void (*discard)(void* ctx);   /* claimed data failed its checksum */
+  const char* (*verify)(uint8_t final, void* ctx);
+                                /* why stored data did not read back, or NULL;
+                                 * final is set before END is acked */
+} IHex8Handler;
+
+typedef struct ihex8_monitor_t {
+  void (*sent)(IHex8Record* rec, void* ctx);    /* rec is NULL for end of file */
+  void (*acked)(IHex8Record* rec, void* ctx);
+  void (*nacked)(IHex8Record* rec, void* ctx);  /* NAK or timeout */
+  void* ctx;
+} IHex8Monitor;
+
+#define IHEX8_WINDOW_MAX 16
+#define IHEX8_RX_BUFFER 64      /* serial receive buffer of an Uno */
+
+typedef struct ihex8_window_t {
+  uint8_t size;                 /* records sent ahead of their acks */
+  uint8_t limit;                /* most it may grow to, 1 is stop and wait */
+  uint8_t streak;               /* acks since it last changed */
+  uint8_t peak;                 /* most records it had in flight */
+  long backoffs;                /* times a NAK or timeout halved it */
+  uint16_t buffer;              /* characters the controller holds while it
+                                 * writes, 0 for IHEX8_RX_BUFFER */
+} IHex8Window;
+
+typedef struct ihex8_page_t {
+  uint16_t address;             /* page number */
+  uint16_t count;               /* number of bytes present */
+  uint8_t* data;                /* page data */
+  uint8_t* present;             /* one bit per byte of data */
+} IHex8Page;
+
+typedef struct ihex8_image_t {
+  uint8_t pageBits;             /* log2 of page size */
+  uint32_t pageCount;           /* number of page slots */
+  IHex8Page** pages;            /* page slots indexed by page number */
+} IHex8Image;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -40,10 +111,48 @@ IHex8Record* ihex8Receive(IHex8* ih);
 int ihex8ReceiveAndStore(IHex8* ih, void* ctx, 
     void(*store)(IHex8Record*, void*));
 
+int ihex8ReceiveWith(IHex8* ih, IHex8Handler* handler);
+
 int ihex8Send(IHex8Record* rec, IHex8* ih);
 
+int ihex8SendWith(IHex8Record* rec, IHex8* ih, IHex8Monitor* monitor);
+
+int ihex8SendWindow(IHex8Record* rec, IHex8Record* end, IHex8* ih, 
+    IHex8Monitor* monitor, IHex8Window* window);
+
+int ihex8Command(IHex8* ih, const char* cmd, char* reply, int replylen);
+
+long ihex8Compress(IHex8Record* rec);
+
 void ihex8Free(IHex8Record* rec);
 
+IHex8Image* ihex8ImageCreate(uint8_t pageBits);
+
+IHex8Image* ihex8LoadImage(IHex8* ih, uint8_t pageBits);
+
+int ihex8ImagePut(IHex8Image* image, uint16_t address, uint8_t data);
+
+int ihex8ImageGet(IHex8Image* image, uint16_t address);
+
+long ihex8ImageStore(IHex8Image* image, IHex8Record* rec);
+
+long ihex8ImageMerge(IHex8Image* dst, IHex8Image* src);
+
+IHex8Image* ihex8ImageDiff(IHex8Image* from, IHex8Image* to);
+
+IHex8Image* ihex8ImageStrip(IHex8Image* image, const uint8_t* pattern,
+    uint8_t patternLength, uint8_t minRun);
+
+IHex8Page* ihex8ImagePage(IHex8Image* image, uint16_t address);
+
+IHex8Page* ihex8ImageNext(IHex8Image* image, IHex8Page* page);
+
+int ihex8PageHas(IHex8Page* page, uint16_t offset);
+
+IHex8Record* ihex8ImageRecords(IHex8Image* image, uint8_t maxLength);
+
+void ihex8ImageFree(IHex8Image* image);
+
 #ifdef __cplusplus
 }
 #endif